@@ -0,0 +1,358 @@
+/*
+ * Mai Controller Analog Buttons
+ * WHowe <github.com/whowechina>
+ *
+ * Hall effect switches on the ADC pins. The ADC free-runs round-robin over
+ * the channels that have a button on them. One DMA channel writes the
+ * conversions into a ring and a second one points it back at the start
+ * each time it fills, so ring index % adc.count is the channel's slot.
+ */
+
+#include "analog.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+
+#include "button.h"
+#include "config.h"
+
+/* 10KHz per channel from the 48MHz ADC clock, the ring holds 6.4ms */
+#define ADC_CLKDIV(n) (48000000 / ((n) * 10000) - 1)
+#define ADC_RING_LEN 256 /* multiple of ANALOG_CHANNELS */
+#define ADC_AVG 8 /* latest samples averaged per channel, by default */
+#define ADC_AVG_MAX 32
+#define ADC_EMPTY 0xffff /* never produced by the 12-bit ADC */
+
+/* Calibrated range is never trusted below this many counts */
+#define MIN_RANGE 200
+#define RELEASE_HYSTERESIS 8
+
+static uint16_t adc_ring[ADC_RING_LEN];
+static uint16_t *adc_ring_start = adc_ring; /* read by the control DMA */
+
+static struct {
+    bool ready;
+    bool running;
+    bool failed;
+    int dma[2]; /* data, control */
+    uint8_t count; /* channels in the round-robin */
+    uint32_t len; /* ring length in use, multiple of count */
+} adc;
+
+static struct {
+    int8_t button; /* -1 if not used */
+    uint8_t slot; /* position in the round-robin */
+    int8_t sign; /* direction of travel, 0 until known */
+    bool calibrated;
+    uint8_t extreme; /* peak while pressed, valley while released */
+    analog_info_t info;
+} channel[ANALOG_CHANNELS];
+
+static uint16_t analog_buttons;
+static uint16_t analog_pressed;
+static int adc_avg = ADC_AVG;
+
+bool analog_wanted(int id, uint8_t gpio)
+{
+    return (mai_cfg->analog.buttons & (1 << id)) &&
+           (gpio >= ANALOG_GPIO_BASE) &&
+           (gpio < ANALOG_GPIO_BASE + ANALOG_CHANNELS);
+}
+
+static bool adc_claim()
+{
+    if (adc.ready) {
+        return true;
+    }
+    int dma0 = dma_claim_unused_channel(false);
+    int dma1 = dma_claim_unused_channel(false);
+    if ((dma0 < 0) || (dma1 < 0)) {
+        if (dma0 >= 0) {
+            dma_channel_unclaim(dma0);
+        }
+        return false;
+    }
+    adc.dma[0] = dma0;
+    adc.dma[1] = dma1;
+    adc_init();
+    adc.ready = true;
+    return true;
+}
+
+static void adc_stop()
+{
+    if (!adc.running) {
+        return;
+    }
+    adc_run(false);
+    /* unchain first, or the control channel re-arms the data channel */
+    dma_channel_config c = dma_get_channel_config(adc.dma[0]);
+    channel_config_set_chain_to(&c, adc.dma[0]);
+    dma_channel_set_config(adc.dma[0], &c, false);
+    dma_channel_abort(adc.dma[1]);
+    dma_channel_abort(adc.dma[0]);
+    adc_set_round_robin(0);
+    adc_fifo_drain();
+    adc.running = false;
+}
+
+static void adc_start()
+{
+    memset(adc_ring, 0xff, sizeof(adc_ring));
+
+    uint32_t mask = 0;
+    for (int ch = 0; ch < ANALOG_CHANNELS; ch++) {
+        if (channel[ch].button >= 0) {
+            mask |= 1 << ch;
+        }
+    }
+
+    adc_select_input(__builtin_ctz(mask));
+    adc_set_round_robin(mask);
+    adc_fifo_setup(true, true, 1, false, false);
+    adc_set_clkdiv(ADC_CLKDIV(adc.count));
+
+    dma_channel_config c = dma_channel_get_default_config(adc.dma[1]);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, false);
+    dma_channel_configure(adc.dma[1], &c,
+                          &dma_channel_hw_addr(adc.dma[0])->al2_write_addr_trig,
+                          &adc_ring_start, 1, false);
+
+    c = dma_channel_get_default_config(adc.dma[0]);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_dreq(&c, DREQ_ADC);
+    channel_config_set_chain_to(&c, adc.dma[1]);
+    dma_channel_configure(adc.dma[0], &c, adc_ring, &adc_hw->fifo,
+                          adc.len, true);
+
+    adc_run(true);
+    adc.running = true;
+}
+
+static uint32_t adc_head()
+{
+    /* sits at the very end for a moment while the control channel runs */
+    uint32_t addr = dma_channel_hw_addr(adc.dma[0])->write_addr;
+    return (addr - (uint32_t)adc_ring) / sizeof(uint16_t) % adc.len;
+}
+
+void analog_init()
+{
+    adc_stop();
+
+    analog_buttons = 0;
+    analog_pressed = 0;
+    adc.failed = false;
+    memset(channel, 0, sizeof(channel));
+    for (int ch = 0; ch < ANALOG_CHANNELS; ch++) {
+        channel[ch].button = -1;
+    }
+
+    for (int i = 0; i < button_num(); i++) {
+        uint8_t gpio = button_real_gpio(i);
+        if (!analog_wanted(i, gpio)) {
+            continue;
+        }
+        int ch = gpio - ANALOG_GPIO_BASE;
+        if (channel[ch].button >= 0) {
+            continue;
+        }
+        channel[ch].button = i;
+        analog_buttons |= 1 << i;
+    }
+
+    if (!analog_buttons) {
+        return;
+    }
+
+    adc.count = 0;
+    for (int ch = 0; ch < ANALOG_CHANNELS; ch++) {
+        if (channel[ch].button >= 0) {
+            channel[ch].slot = adc.count++;
+        }
+    }
+    adc.len = adc.count * (ADC_RING_LEN / ANALOG_CHANNELS);
+
+    if (!adc_claim()) {
+        adc.failed = true;
+        analog_buttons = 0;
+        return;
+    }
+
+    for (int ch = 0; ch < ANALOG_CHANNELS; ch++) {
+        if (channel[ch].button >= 0) {
+            adc_gpio_init(ANALOG_GPIO_BASE + ch);
+        }
+    }
+
+    adc_start();
+}
+
+/* average of the latest adc_avg conversions, ADC_EMPTY if not there yet */
+static uint16_t channel_raw(int ch, uint32_t head)
+{
+    uint32_t pos = head + adc.len - 1;
+    pos -= (pos - channel[ch].slot) % adc.count;
+
+    uint32_t sum = 0;
+    for (int i = 0; i < adc_avg; i++) {
+        uint16_t sample = adc_ring[(pos - i * adc.count) % adc.len];
+        if (sample == ADC_EMPTY) {
+            return ADC_EMPTY;
+        }
+        sum += sample;
+    }
+    return sum / adc_avg;
+}
+
+/*
+ * Rest is taken from the first reading, the bottom is the furthest point
+ * ever reached. Which way the magnet moves the reading is learned the
+ * first time it leaves the rest by MIN_RANGE.
+ */
+static uint8_t channel_travel(int ch, uint16_t raw)
+{
+    analog_info_t *info = &channel[ch].info;
+    if (!channel[ch].calibrated) {
+        info->rest = raw;
+        info->range = 0;
+        channel[ch].sign = 0;
+        channel[ch].calibrated = true;
+    }
+
+    int32_t dev = raw - info->rest;
+    if (channel[ch].sign == 0) {
+        if (abs(dev) >= MIN_RANGE) {
+            channel[ch].sign = (dev > 0) ? 1 : -1;
+        }
+        dev = abs(dev);
+    } else {
+        dev *= channel[ch].sign;
+    }
+
+    if (dev < 0) {
+        /* wasn't fully released when we took the rest, follow it */
+        info->rest = raw;
+        info->range -= dev;
+        dev = 0;
+    }
+    if (dev > info->range) {
+        info->range = dev;
+    }
+
+    uint32_t range = (info->range < MIN_RANGE) ? MIN_RANGE : info->range;
+    return dev * 255 / range;
+}
+
+/*
+ * Past the actuation point a pressed switch releases as soon as it rises
+ * by the release delta from its lowest point, and re-presses when it goes
+ * down by the press delta again. Zero deltas give a plain threshold.
+ */
+static bool channel_pressed(int ch, uint8_t travel, bool pressed)
+{
+    int id = channel[ch].button;
+    int actuation = mai_hot.analog_actuation[id];
+    int press = mai_hot.analog_press[id];
+    int release = mai_hot.analog_release[id];
+    uint8_t *extreme = &channel[ch].extreme;
+
+    if (pressed) {
+        if (travel > *extreme) {
+            *extreme = travel;
+        }
+        if ((travel + RELEASE_HYSTERESIS < actuation) ||
+            (release && (travel + release <= *extreme))) {
+            *extreme = travel;
+            return false;
+        }
+        return true;
+    }
+
+    if (travel < *extreme) {
+        *extreme = travel;
+    }
+    if ((travel >= actuation) && (!press || (travel >= *extreme + press))) {
+        *extreme = travel;
+        return true;
+    }
+    return false;
+}
+
+void analog_update()
+{
+    if (!adc.running) {
+        return;
+    }
+
+    uint32_t head = adc_head();
+    for (int ch = 0; ch < ANALOG_CHANNELS; ch++) {
+        int id = channel[ch].button;
+        if (id < 0) {
+            continue;
+        }
+        uint16_t raw = channel_raw(ch, head);
+        if (raw == ADC_EMPTY) {
+            continue;
+        }
+
+        analog_info_t *info = &channel[ch].info;
+        info->raw = raw;
+        info->travel = channel_travel(ch, raw);
+        info->pressed = channel_pressed(ch, info->travel, info->pressed);
+        if (info->pressed) {
+            analog_pressed |= 1 << id;
+        } else {
+            analog_pressed &= ~(1 << id);
+        }
+    }
+}
+
+bool analog_ok()
+{
+    return !adc.failed;
+}
+
+uint16_t analog_mask()
+{
+    return analog_buttons;
+}
+
+uint16_t analog_read()
+{
+    return analog_pressed;
+}
+
+void analog_set_average(int samples)
+{
+    if (samples <= 0) {
+        samples = ADC_AVG;
+    }
+    adc_avg = (samples > ADC_AVG_MAX) ? ADC_AVG_MAX : samples;
+}
+
+void analog_calibrate()
+{
+    for (int ch = 0; ch < ANALOG_CHANNELS; ch++) {
+        channel[ch].calibrated = false;
+    }
+}
+
+const analog_info_t *analog_info(int id)
+{
+    for (int ch = 0; ch < ANALOG_CHANNELS; ch++) {
+        if ((channel[ch].button == id) && (id >= 0)) {
+            return &channel[ch].info;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,40 @@
+/*
+ * Mai Controller Analog Buttons
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef ANALOG_H
+#define ANALOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* ADC capable pins are GPIO 26..29, ADC channel is gpio - 26 */
+#define ANALOG_GPIO_BASE 26
+#define ANALOG_CHANNELS 4
+
+/* Travel is normalized to 0 (rest) .. 255 (bottom) */
+#define ANALOG_ACTUATION_DEFAULT 128
+
+bool analog_wanted(int id, uint8_t gpio);
+void analog_init();
+void analog_update();
+bool analog_ok();
+
+uint16_t analog_mask(); // buttons driven by analog readings
+uint16_t analog_read(); // pressed analog buttons
+
+void analog_calibrate();
+void analog_set_average(int samples); // 0: default
+
+typedef struct {
+    uint16_t raw;
+    uint16_t rest;
+    uint16_t range;
+    uint8_t travel;
+    bool pressed;
+} analog_info_t;
+
+const analog_info_t *analog_info(int id); // NULL if id is not analog
+
+#endif
@@ -19,7 +19,6 @@
 #define SPI_MOSI 19
 #define SPI_NSS 17
 
-#define UART_ITF 1
 #define UART_PORT uart1
 #define UART_IRQ UART1_IRQ
 #define UART_TX 8
@@ -46,6 +45,18 @@
 #else
 #define BUTTON_DEF { 1, 0, 4, 5, 8, 9, 3, 2, 12, 11, 10, 14 }
 #endif
+#define SERVICE_BUTTON 9
+
+/* Optional 74HC165 chain for extra buttons */
+#ifdef AZAMAI_BUILD
+#define EXPANDER_PL 1
+#define EXPANDER_CLK 2
+#define EXPANDER_QH 3
+#else
+#define EXPANDER_PL 16
+#define EXPANDER_CLK 17
+#define EXPANDER_QH 18
+#endif
 
 /* HID Keycode: https://github.com/hathach/tinyusb/blob/master/src/class/hid/hid.h */
 // P1: WEDCXZAQ3(F1)(F2)(F3) P2: (Numpad)89632147*(F1)(F2)(F3)
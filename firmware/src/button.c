@@ -9,15 +9,20 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-#ifdef AZAMAI_BUILD
 #include <string.h>
-#endif
 
 #include "hardware/gpio.h"
+#include "hardware/dma.h"
+#include "hardware/pio.h"
+#include "hardware/sync.h"
 #include "hardware/timer.h"
 #include "hardware/pwm.h"
 
+#include "button.pio.h"
+
+#include "analog.h"
 #include "config.h"
+#include "event.h"
 #include "board_defs.h"
 
 static const uint8_t gpio_def[] = BUTTON_DEF;
@@ -25,46 +30,744 @@ static uint8_t gpio_real[] = BUTTON_DEF;
 
 #define BUTTON_NUM (sizeof(gpio_def))
 
-static bool sw_val[BUTTON_NUM]; /* true if pressed */
-static uint64_t sw_freeze_time[BUTTON_NUM];
+/* gpio_get_all() ^ active_xor gives 1 for pressed switches */
+static uint32_t gpio_mask;
+static uint32_t active_xor;
+static uint8_t gpio_button[32];
+static uint32_t gpio_buttons; /* buttons read from GPIOs, in button order */
+
+static inline uint32_t button_sample()
+{
+    return (gpio_get_all() ^ active_xor) & gpio_mask;
+}
+
+/* gather GPIO space bits into button order, only when something flips */
+static uint32_t button_pack(uint32_t state)
+{
+    uint32_t buttons = 0;
+    for (int i = BUTTON_NUM - 1; i >= 0; i--) {
+        buttons <<= 1;
+        if (state & (1 << gpio_real[i])) {
+            buttons |= 1;
+        }
+    }
+    return buttons;
+}
+
+/* If a switch flips, it freezes for a while, the IO4 host can ask for more
+   through its sampling count, one sample per BUTTON_SAMPLE_US */
+#define DEBOUNCE_FREEZE_TIME_US 3000
+#define BUTTON_SAMPLE_US 1000
+#define FREEZE_CNT_BITS 10
+
+static uint32_t freeze_us[BUTTON_MAX];
+static volatile uint8_t sampling_req;
+static uint8_t sampling;
+
+/*
+ * Chatter statistics. A bounce is a raw edge seen while the switch is
+ * frozen, its width is how long after the flip it happened.
+ */
+static const uint16_t bounce_bounds[] = BUTTON_BOUNCE_BOUNDS;
+
+static struct {
+    button_stat_t stat;
+    uint32_t flip_time;
+    uint32_t span;
+} chatter[BUTTON_MAX];
+
+static uint32_t ring_overruns;
+
+static void stat_flip(int id, bool pressed, uint32_t now)
+{
+    button_stat_t *stat = &chatter[id].stat;
+
+    if (chatter[id].span > 0) {
+        int bucket = 0;
+        while ((bucket < BUTTON_BOUNCE_HIST_NUM - 1) &&
+               (chatter[id].span >= bounce_bounds[bucket])) {
+            bucket++;
+        }
+        stat->hist[bucket]++;
+        chatter[id].span = 0;
+    }
+
+    if (!pressed && (stat->flips > 0)) {
+        uint32_t width = now - chatter[id].flip_time;
+        if ((stat->min_press_us == 0) || (width < stat->min_press_us)) {
+            stat->min_press_us = width;
+        }
+    }
+
+    stat->flips++;
+    chatter[id].flip_time = now;
+}
+
+static void stat_bounce(int id, uint32_t now)
+{
+    button_stat_t *stat = &chatter[id].stat;
+    uint32_t span = now - chatter[id].flip_time;
+
+    stat->bounces++;
+    if (span > chatter[id].span) {
+        chatter[id].span = span;
+    }
+    if (span > stat->max_bounce_us) {
+        stat->max_bounce_us = span;
+    }
+}
+
+/* flips and chatters are in lane bit space, ids maps bits to buttons */
+static void stat_update(const uint8_t *ids, uint32_t flips, uint32_t chatters,
+                        uint32_t state, uint32_t now)
+{
+    uint32_t bits = flips | chatters;
+    while (bits) {
+        int bit = __builtin_ctz(bits);
+        bits &= bits - 1;
+        int id = ids[bit];
+        if (id >= BUTTON_MAX) {
+            continue;
+        }
+        if (flips & (1u << bit)) {
+            stat_flip(id, state & (1u << bit), now);
+        } else {
+            stat_bounce(id, now);
+        }
+    }
+}
+
+const button_stat_t *button_stat(int id)
+{
+    if (id >= BUTTON_MAX) {
+        return NULL;
+    }
+    return &chatter[id].stat;
+}
+
+void button_stat_reset()
+{
+    memset(chatter, 0, sizeof(chatter));
+    ring_overruns = 0;
+}
+
+uint32_t button_ring_overruns()
+{
+    return ring_overruns;
+}
+
+/*
+ * All switches of a lane (GPIOs, or an expander chain) are debounced together
+ * in its bit space. Each switch has a freeze counter spread vertically over
+ * cnt[], bit i of cnt[n] being bit n of switch i's counter, so one sample
+ * costs a handful of word operations.
+ */
+typedef struct {
+    uint32_t state; /* set if pressed */
+    uint32_t frozen;
+    uint32_t cnt[FREEZE_CNT_BITS];
+    uint32_t load[FREEZE_CNT_BITS];
+    uint32_t last; /* last raw sample */
+    uint32_t clock; /* in us, advances one period per sample */
+    uint32_t period;
+    const uint8_t *ids; /* lane bit to button id, 0xff if none */
+} debounce_t;
+
+static debounce_t debounce;
+
+/* freeze times into counter load values, keeps the running state */
+static void debounce_load(debounce_t *lane)
+{
+    memset(lane->load, 0, sizeof(lane->load));
+    for (int bit = 0; bit < 32; bit++) {
+        int id = lane->ids[bit];
+        if (id >= BUTTON_MAX) {
+            continue;
+        }
+        uint32_t samples = freeze_us[id] / lane->period;
+        if (samples > 0) {
+            samples--; /* the flipping sample counts */
+        }
+        if (samples >= (1 << FREEZE_CNT_BITS)) {
+            samples = (1 << FREEZE_CNT_BITS) - 1;
+        }
+        for (int i = 0; i < FREEZE_CNT_BITS; i++) {
+            if (samples & (1 << i)) {
+                lane->load[i] |= 1u << bit;
+            }
+        }
+    }
+}
+
+static void debounce_init(debounce_t *lane, const uint8_t *ids, uint32_t period_us)
+{
+    memset(lane, 0, sizeof(*lane));
+    lane->ids = ids;
+    lane->period = period_us;
+    lane->clock = time_us_32(); /* same time base as edge capture */
+    debounce_load(lane);
+}
+
+/* returns switches flipped by this sample */
+static inline uint32_t debounce_feed(debounce_t *lane, uint32_t sample)
+{
+    lane->clock += lane->period;
+    if ((sample == lane->state) && !lane->frozen) {
+        lane->last = sample;
+        return 0;
+    }
+
+    uint32_t chatters = (sample ^ lane->last) & lane->frozen;
+    uint32_t flips = (sample ^ lane->state) & ~lane->frozen;
+    lane->last = sample;
+    lane->state ^= flips;
+
+    uint32_t borrow = lane->frozen;
+    uint32_t frozen = 0;
+    for (int i = 0; i < FREEZE_CNT_BITS; i++) {
+        uint32_t cnt = lane->cnt[i];
+        cnt ^= borrow;
+        borrow &= cnt;
+        cnt |= flips & lane->load[i];
+        lane->cnt[i] = cnt;
+        frozen |= cnt;
+    }
+    lane->frozen = frozen;
+
+    if (flips | chatters) {
+        stat_update(lane->ids, flips, chatters, lane->state, lane->clock);
+    }
+
+    return flips;
+}
+
+static uint32_t button_state;
+static uint32_t button_reading;
+static uint32_t button_presses;
+
+/*
+ * Delay line, one entry per tick: low half is the state, high half is the
+ * presses seen during that tick. Readers tap it at their own delay.
+ */
+static struct {
+    uint64_t history[BUTTON_DELAY_LEN];
+    uint32_t head;
+    uint32_t presses; /* presses which came out of the button tap */
+} delay;
+
+/*
+ * Edge capture: GPIO edge interrupts flip a switch the moment it happens,
+ * then lock it out for the freeze time to reject chatter. The tick only
+ * re-syncs switches whose settling edge was swallowed by the lockout.
+ */
+#define EDGE_LOG_SIZE 8
+
+static uint8_t mode;
+static uint32_t capture_mask;
+
+static struct {
+    uint32_t state; /* set if pressed, GPIO space */
+    uint64_t lockout[BUTTON_NUM];
+} capture;
+
+static struct {
+    uint64_t time[EDGE_LOG_SIZE];
+    uint32_t count;
+} edge_log[BUTTON_NUM];
+
+/* every change of button_state goes through here */
+static void button_change(uint32_t state, uint32_t now)
+{
+    uint32_t last = button_state;
+    if (state == last) {
+        return;
+    }
+    button_state = state;
+    button_presses |= state & ~last;
+    event_publish(EVENT_BUTTON, state, state ^ last, now);
+}
+
+static void capture_flip(int id, uint64_t now)
+{
+    capture.state ^= 1 << gpio_real[id];
+    capture.lockout[id] = now + freeze_us[id];
+    stat_flip(id, capture.state & (1 << gpio_real[id]), now);
+    button_change(button_state ^ (1 << id), now);
+    if (mai_hot.delay_button == 0) {
+        button_reading = button_state;
+    }
+}
+
+static void (*change_cb)();
+
+static void capture_isr()
+{
+    uint64_t now = time_us_64();
+    uint32_t drift = button_sample() ^ capture.state;
+    uint32_t last = button_state;
+
+    for (int i = 0; i < BUTTON_NUM; i++) {
+        uint8_t gpio = gpio_real[i];
+        uint32_t events = gpio_get_irq_event_mask(gpio) &
+                          (GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL);
+        if (!events) {
+            continue;
+        }
+        gpio_acknowledge_irq(gpio, events);
+
+        edge_log[i].time[edge_log[i].count % EDGE_LOG_SIZE] = now;
+        edge_log[i].count++;
+
+        if (now < capture.lockout[i]) {
+            stat_bounce(i, now);
+        } else if (drift & (1 << gpio)) {
+            capture_flip(i, now);
+        }
+    }
+
+    if ((button_state != last) && change_cb) {
+        change_cb();
+    }
+}
+
+static void capture_stop()
+{
+    if (!capture_mask) {
+        return;
+    }
+    for (int i = 0; i < 32; i++) {
+        if (capture_mask & (1 << i)) {
+            gpio_set_irq_enabled(i, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, false);
+        }
+    }
+    gpio_remove_raw_irq_handler_masked(capture_mask, capture_isr);
+    capture_mask = 0;
+}
+
+static void capture_start()
+{
+    memset(&capture, 0, sizeof(capture));
+    memset(edge_log, 0, sizeof(edge_log));
+    capture.state = button_sample();
+    button_state = button_pack(capture.state);
+
+    capture_mask = gpio_mask;
+    gpio_add_raw_irq_handler_masked(capture_mask, capture_isr);
+    for (int i = 0; i < BUTTON_NUM; i++) {
+        if (capture_mask & (1 << gpio_real[i])) {
+            gpio_set_irq_enabled(gpio_real[i], GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true);
+        }
+    }
+    irq_set_enabled(IO_IRQ_BANK0, true);
+}
+
+static void capture_update()
+{
+    uint32_t drift = button_sample() ^ capture.state;
+    if (!drift) {
+        return;
+    }
+
+    uint64_t now = time_us_64();
+    uint32_t ints = save_and_disable_interrupts();
+    drift = button_sample() ^ capture.state;
+    for (int i = 0; i < BUTTON_NUM; i++) {
+        if ((drift & (1 << gpio_real[i])) && (now >= capture.lockout[i])) {
+            capture_flip(i, now);
+        }
+    }
+    restore_interrupts(ints);
+}
+
+uint32_t button_edge_count(int id)
+{
+    if (id >= BUTTON_NUM) {
+        return 0;
+    }
+    return edge_log[id].count;
+}
+
+uint64_t button_edge_time(int id, int back)
+{
+    if ((id >= BUTTON_NUM) || (back >= EDGE_LOG_SIZE) ||
+        (back >= edge_log[id].count)) {
+        return 0;
+    }
+    return edge_log[id].time[(edge_log[id].count - 1 - back) % EDGE_LOG_SIZE];
+}
+
+/*
+ * PIO sampler: a PIO1 state machine samples all GPIOs at SAMPLER_RATE_HZ and
+ * two chained DMA channels keep writing the words into a circular buffer.
+ * The tick then debounces every new sample, so freeze time is counted in
+ * real samples and the CPU never touches the GPIOs.
+ */
+#define SAMPLER_RATE_HZ 50000
+#define SAMPLER_RING_LEN 512 /* 10ms at 50KHz */
+
+static uint32_t sampler_ring[SAMPLER_RING_LEN]
+    __attribute__((aligned(sizeof(uint32_t) * SAMPLER_RING_LEN)));
+
+/* A PIO1 state machine whose RX FIFO is drained into a ring by chained DMA */
+typedef struct {
+    bool ready;
+    bool running;
+    uint sm;
+    uint offset;
+    int dma[2];
+    uint32_t tail;
+    uint64_t read_at;
+} pio_ring_t;
+
+static pio_ring_t sampler;
+
+static bool pio_ring_claim(pio_ring_t *ctx, const pio_program_t *program)
+{
+    if (ctx->ready) {
+        return true;
+    }
+    if (!pio_can_add_program(pio1, program)) {
+        return false;
+    }
+    int sm = pio_claim_unused_sm(pio1, false);
+    if (sm < 0) {
+        return false;
+    }
+    int dma0 = dma_claim_unused_channel(false);
+    int dma1 = dma_claim_unused_channel(false);
+    if ((dma0 < 0) || (dma1 < 0)) {
+        if (dma0 >= 0) {
+            dma_channel_unclaim(dma0);
+        }
+        pio_sm_unclaim(pio1, sm);
+        return false;
+    }
+    ctx->sm = sm;
+    ctx->offset = pio_add_program(pio1, program);
+    ctx->dma[0] = dma0;
+    ctx->dma[1] = dma1;
+    ctx->ready = true;
+    return true;
+}
+
+static void pio_ring_stop(pio_ring_t *ctx)
+{
+    if (!ctx->running) {
+        return;
+    }
+    pio_sm_set_enabled(pio1, ctx->sm, false);
+    for (int i = 0; i < 2; i++) {
+        /* unchain first, or aborting one channel may kick the other */
+        dma_channel_config c = dma_get_channel_config(ctx->dma[i]);
+        channel_config_set_chain_to(&c, ctx->dma[i]);
+        dma_channel_set_config(ctx->dma[i], &c, false);
+    }
+    dma_channel_abort(ctx->dma[0]);
+    dma_channel_abort(ctx->dma[1]);
+    ctx->running = false;
+}
+
+/* ring must be aligned to its size, len words in a power of 2 */
+static void pio_ring_start(pio_ring_t *ctx, uint32_t *ring, uint32_t len)
+{
+    pio_sm_clear_fifos(pio1, ctx->sm);
+    for (int i = 0; i < 2; i++) {
+        dma_channel_config c = dma_channel_get_default_config(ctx->dma[i]);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, true);
+        channel_config_set_ring(&c, true, __builtin_ctz(len * sizeof(uint32_t)));
+        channel_config_set_dreq(&c, pio_get_dreq(pio1, ctx->sm, false));
+        channel_config_set_chain_to(&c, ctx->dma[1 - i]);
+        dma_channel_configure(ctx->dma[i], &c, ring,
+                              &pio1->rxf[ctx->sm], len, i == 0);
+    }
+    ctx->tail = 0;
+    ctx->read_at = time_us_64();
+    ctx->running = true;
+}
+
+static uint32_t pio_ring_head(pio_ring_t *ctx, uint32_t *ring, uint32_t len)
+{
+    int ch = dma_channel_is_busy(ctx->dma[1]) ? ctx->dma[1] : ctx->dma[0];
+    uint32_t addr = dma_channel_hw_addr(ch)->write_addr;
+    return (addr - (uint32_t)ring) / sizeof(uint32_t) % len;
+}
+
+/*
+ * The head is only known modulo the ring, so a reader starved for (close
+ * to) a whole ring can't tell new samples from overwritten ones. Judged
+ * by time instead: past 7/8 of a ring, it skips to the head and counts
+ * an overrun rather than replaying stale samples.
+ */
+static void pio_ring_check(pio_ring_t *ctx, uint32_t head, uint32_t len, uint32_t rate_hz)
+{
+    uint64_t now = time_us_64();
+    uint64_t elapsed = now - ctx->read_at;
+    ctx->read_at = now;
+    if (elapsed * rate_hz >= (uint64_t)(len - len / 8) * 1000000) {
+        ctx->tail = head;
+        ring_overruns++;
+    }
+}
+
+static void sampler_stop()
+{
+    pio_ring_stop(&sampler);
+}
+
+static bool sampler_start()
+{
+    if (!pio_ring_claim(&sampler, &button_sampler_program)) {
+        return false;
+    }
+    pio_ring_start(&sampler, sampler_ring, SAMPLER_RING_LEN);
+    button_sampler_program_init(pio1, sampler.sm, sampler.offset, SAMPLER_RATE_HZ);
+    return true;
+}
+
+static uint32_t sampler_update()
+{
+    uint32_t head = pio_ring_head(&sampler, sampler_ring, SAMPLER_RING_LEN);
+    pio_ring_check(&sampler, head, SAMPLER_RING_LEN, SAMPLER_RATE_HZ);
+    uint32_t flips = 0;
+    while (sampler.tail != head) {
+        uint32_t sample = (sampler_ring[sampler.tail] ^ active_xor) & gpio_mask;
+        flips |= debounce_feed(&debounce, sample);
+        sampler.tail = (sampler.tail + 1) % SAMPLER_RING_LEN;
+    }
+    return flips;
+}
+
+/*
+ * Expander: a chain of 74HC165 shift registers clocked by another PIO1
+ * state machine into its own ring, chain bit n becomes button
+ * BUTTON_NUM + n. It has its own debounce lane and runs whatever the
+ * button mode is.
+ */
+#define EXPANDER_SM_HZ 4000000
+#define EXPANDER_FRAME_CYCLES 160 /* see button.pio */
+#define EXPANDER_PERIOD_US (EXPANDER_FRAME_CYCLES * 1000000 / EXPANDER_SM_HZ)
+#define EXPANDER_RING_LEN 256 /* 10ms at 25KHz */
+
+static uint32_t expander_ring[EXPANDER_RING_LEN]
+    __attribute__((aligned(sizeof(uint32_t) * EXPANDER_RING_LEN)));
+
+static struct {
+    pio_ring_t pio;
+    bool failed;
+    uint32_t mask;
+    uint32_t xor;
+    uint8_t bits;
+    uint8_t ids[32];
+    debounce_t lane;
+} expander;
+
+static void expander_stop()
+{
+    if (!expander.pio.running) {
+        return;
+    }
+    pio_ring_stop(&expander.pio);
+    gpio_init(EXPANDER_PL);
+    gpio_init(EXPANDER_CLK);
+}
+
+static void expander_start()
+{
+    expander.bits = 0;
+    expander.failed = false;
+
+    uint8_t bits = mai_cfg->expander.bits;
+    if (bits == 0) {
+        return;
+    }
+
+    const uint8_t pins[] = { EXPANDER_PL, EXPANDER_CLK, EXPANDER_QH };
+    for (int i = 0; i < 3; i++) {
+        if (gpio_button[pins[i]] < BUTTON_MAX) {
+            expander.failed = true; /* pin taken by a button */
+            return;
+        }
+    }
+
+    if (!pio_ring_claim(&expander.pio, &button_hc165_program)) {
+        expander.failed = true;
+        return;
+    }
+
+    expander.bits = bits;
+    expander.mask = (1ULL << bits) - 1;
+    expander.xor = mai_cfg->expander.active_high ? 0 : expander.mask;
+    memset(expander.ids, 0xff, sizeof(expander.ids));
+    for (int i = 0; i < bits; i++) {
+        expander.ids[i] = BUTTON_NUM + i;
+    }
+    debounce_init(&expander.lane, expander.ids, EXPANDER_PERIOD_US);
+
+    pio_ring_start(&expander.pio, expander_ring, EXPANDER_RING_LEN);
+    button_hc165_program_init(pio1, expander.pio.sm, expander.pio.offset,
+                              EXPANDER_PL, EXPANDER_CLK, EXPANDER_QH,
+                              EXPANDER_SM_HZ);
+}
+
+static uint32_t expander_update()
+{
+    if (!expander.pio.running) {
+        return 0;
+    }
+    uint32_t head = pio_ring_head(&expander.pio, expander_ring, EXPANDER_RING_LEN);
+    pio_ring_check(&expander.pio, head, EXPANDER_RING_LEN, 1000000 / EXPANDER_PERIOD_US);
+    uint32_t flips = 0;
+    while (expander.pio.tail != head) {
+        uint32_t sample = (expander_ring[expander.pio.tail] ^ expander.xor) & expander.mask;
+        flips |= debounce_feed(&expander.lane, sample);
+        expander.pio.tail = (expander.pio.tail + 1) % EXPANDER_RING_LEN;
+    }
+    return flips;
+}
+
+uint8_t button_expander_num()
+{
+    return expander.bits;
+}
+
+bool button_expander_ok()
+{
+    return !expander.failed;
+}
+
+uint8_t button_mode()
+{
+    return mode;
+}
+
+void button_on_change(void (*callback)())
+{
+    change_cb = callback;
+}
+
+uint32_t button_freeze_us(int id)
+{
+    if (id >= BUTTON_MAX) {
+        return 0;
+    }
+    return freeze_us[id];
+}
+
+/* Shortest freeze time covering all bounces seen, 0 if not enough data */
+uint32_t button_freeze_suggest(int id)
+{
+    if ((id >= BUTTON_MAX) || (chatter[id].stat.flips < BUTTON_TUNE_MIN_FLIPS)) {
+        return 0;
+    }
+
+    uint32_t resolution = (id >= BUTTON_NUM) ? expander.lane.period :
+                          (mode == BUTTON_MODE_CAPTURE) ? 100 : debounce.period;
+    uint32_t freeze = chatter[id].stat.max_bounce_us * 3 / 2 + resolution;
+    freeze = (freeze + 99) / 100 * 100;
+    if (freeze < 500) {
+        freeze = 500;
+    }
+    if (freeze > 25500) {
+        freeze = 25500;
+    }
+    return freeze;
+}
+
+static void freeze_setup()
+{
+    uint32_t floor = sampling * BUTTON_SAMPLE_US;
+    for (int id = 0; id < BUTTON_MAX; id++) {
+        uint8_t freeze = (id < BUTTON_NUM) ? mai_cfg->button.freeze[id] : 0;
+        uint32_t us = freeze ? freeze * 100 : DEBOUNCE_FREEZE_TIME_US;
+        freeze_us[id] = (us < floor) ? floor : us;
+    }
+}
+
+/* applied by button_update(), a host request comes from the USB task */
+static void sampling_apply()
+{
+    sampling = sampling_req;
+    freeze_setup();
+    debounce_load(&debounce);
+    if (expander.pio.running) {
+        debounce_load(&expander.lane);
+    }
+    analog_set_average(sampling);
+}
+
+void button_set_sampling(uint8_t count)
+{
+    sampling_req = (count > BUTTON_SAMPLING_MAX) ? BUTTON_SAMPLING_MAX : count;
+}
 
 void button_init()
 {
+    capture_stop();
+    sampler_stop();
+    expander_stop();
+    freeze_setup();
+
+    gpio_mask = 0;
+    active_xor = 0;
+    gpio_buttons = 0;
+    memset(gpio_button, 0xff, sizeof(gpio_button));
     for (int i = 0; i < BUTTON_NUM; i++)
     {
-        sw_val[i] = false;
-        sw_freeze_time[i] = 0;
         uint8_t gpio = mai_cfg->alt.buttons[i];
         if (gpio > 29) {
             gpio = gpio_def[i];
         }
         gpio_real[i] = gpio;
+
+        if (analog_wanted(i, gpio)) {
+            continue; /* ADC input, set up by analog_init() */
+        }
+
         gpio_init(gpio);
         gpio_set_function(gpio, GPIO_FUNC_SIO);
         gpio_set_dir(gpio, GPIO_IN);
         gpio_pull_up(gpio);
+
+        bool active_high = i < 8 ? mai_cfg->tweak.main_button_active_high :
+                                   mai_cfg->tweak.aux_button_active_high;
+        gpio_mask |= 1 << gpio;
+        if (!active_high) {
+            active_xor |= 1 << gpio;
+        }
+        gpio_button[gpio] = i;
+        gpio_buttons |= 1 << i;
     }
-}
 
-static inline bool button_pressed(int id)
-{
-    bool reading = gpio_get(gpio_real[id]);
-    bool active_level = id < 8 ? mai_cfg->tweak.main_button_active_high :
-                                 mai_cfg->tweak.aux_button_active_high;
+    button_state = 0;
+    mode = mai_cfg->button.mode;
+
+    if ((mode == BUTTON_MODE_PIO) && !sampler_start()) {
+        mode = BUTTON_MODE_POLL;
+    }
+
+    if (mode == BUTTON_MODE_PIO) {
+        debounce_init(&debounce, gpio_button, 1000000 / SAMPLER_RATE_HZ);
+    } else {
+        debounce_init(&debounce, gpio_button, BUTTON_SAMPLE_US);
+    }
 
-    return reading == active_level;
+    if (mode == BUTTON_MODE_CAPTURE) {
+        capture_start();
+    }
+
+    expander_start();
+    analog_init();
 }
 
 bool button_is_stuck()
 {
 #ifndef AZAMAI_BUILD
-    for (int i = 0; i < BUTTON_NUM; i++) {
-        if (button_pressed(i)) {
-            return true;
-        }
-    }
-#endif
+    return button_sample() != 0;
+#else
     return false;
+#endif
 }
 
 uint8_t button_num()
@@ -88,49 +791,83 @@ uint8_t button_default_gpio(int id)
     return gpio_def[id];
 }
 
-static uint16_t button_reading;
-
-/* If a switch flips, it freezes for a while */
-#define DEBOUNCE_FREEZE_TIME_US 3000
-#ifdef AZAMAI_BUILD
-#define DELAY_TICKS 0
-#endif
 void button_update()
 {
-    uint64_t now = time_us_64();
-    uint16_t buttons = 0;
+    if (sampling != sampling_req) {
+        sampling_apply();
+    }
 
-    for (int i = BUTTON_NUM - 1; i >= 0; i--) {
-        bool sw_pressed = button_pressed(i);
-        
-        if (now >= sw_freeze_time[i]) {
-            if (sw_pressed != sw_val[i]) {
-                sw_val[i] = sw_pressed;
-                sw_freeze_time[i] = now + DEBOUNCE_FREEZE_TIME_US;
-            }
+    if (mode == BUTTON_MODE_CAPTURE) {
+        capture_update();
+    } else {
+        uint32_t flips = (mode == BUTTON_MODE_PIO) ? sampler_update() :
+                                                     debounce_feed(&debounce, button_sample());
+        if (flips) {
+            button_change((button_state & ~gpio_buttons) | button_pack(debounce.state),
+                          time_us_32());
         }
+    }
 
-        buttons <<= 1;
-        if (sw_val[i]) {
-            buttons |= 1;
-        }
+    if (expander_update()) {
+        uint32_t mask = expander.mask << BUTTON_NUM;
+        uint32_t ints = save_and_disable_interrupts();
+        button_change((button_state & ~mask) | (expander.lane.state << BUTTON_NUM),
+                      time_us_32());
+        restore_interrupts(ints);
     }
 
-#ifdef AZAMAI_BUILD
-    if (DELAY_TICKS != 0) {
-        static uint16_t button_history[DELAY_TICKS];
-        button_reading = button_history[0];
-        memmove(&button_history[0], &button_history[1], sizeof(button_history[0]) * (DELAY_TICKS - 1));
-        button_history[DELAY_TICKS - 1] = buttons;
-    } else {
-        button_reading = buttons;
+    uint32_t analog = analog_mask();
+    if (analog) {
+        analog_update();
+        uint32_t ints = save_and_disable_interrupts();
+        button_change((button_state & ~analog) | analog_read(), time_us_32());
+        restore_interrupts(ints);
     }
-#else
-    button_reading = buttons;
-#endif
+
+    uint8_t ticks = mai_hot.delay_button;
+    if (ticks == 0) {
+        button_reading = button_state;
+        delay.history[++delay.head % BUTTON_DELAY_LEN] = button_state;
+        return;
+    }
+
+    uint32_t ints = save_and_disable_interrupts();
+    uint32_t presses = button_presses;
+    button_presses = 0;
+    restore_interrupts(ints);
+
+    delay.history[++delay.head % BUTTON_DELAY_LEN] = button_state | ((uint64_t)presses << 32);
+
+    uint64_t tap = delay.history[(delay.head - ticks) % BUTTON_DELAY_LEN];
+    button_reading = (uint32_t)tap;
+    delay.presses |= tap >> 32;
 }
 
-uint16_t button_read()
+uint32_t button_read()
 {
     return button_reading;
 }
+
+uint32_t button_read_delayed(uint8_t ticks)
+{
+    if (ticks == 0) {
+        return button_state;
+    }
+    if (ticks >= BUTTON_DELAY_LEN) {
+        ticks = BUTTON_DELAY_LEN - 1;
+    }
+    return (uint32_t)delay.history[(delay.head - ticks) % BUTTON_DELAY_LEN];
+}
+
+uint32_t button_take_presses()
+{
+    uint32_t ints = save_and_disable_interrupts();
+    uint32_t presses = delay.presses;
+    delay.presses = 0;
+    if (mai_hot.delay_button == 0) {
+        presses |= button_presses;
+        button_presses = 0;
+    }
+    restore_interrupts(ints);
+    return presses;
+}
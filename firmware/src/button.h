@@ -10,15 +10,64 @@
 #include <stdbool.h>
 #include "hardware/flash.h"
 
+enum button_mode {
+    BUTTON_MODE_POLL = 0,
+    BUTTON_MODE_CAPTURE,
+    BUTTON_MODE_PIO,
+};
+
+/* 12 direct buttons first, then expander chain bits */
+#define BUTTON_MAX 32
+
 void button_init();
 
 /* if anykey is pressed, no debounce */
 bool button_is_stuck();
 
 uint8_t button_num();
+uint8_t button_mode(); // mode actually running
+
+/* Called from the IRQ when edge capture flips a button */
+void button_on_change(void (*callback)());
 void button_update();
-uint16_t button_read();
+uint32_t button_read();
+uint32_t button_take_presses(); // presses seen since last call
+
+/* Max delay is BUTTON_DELAY_LEN - 1 ticks, must be a power of 2 */
+#define BUTTON_DELAY_LEN 64
+uint32_t button_read_delayed(uint8_t ticks);
 uint8_t button_real_gpio(int id);
 uint8_t button_default_gpio(int id);
 
+uint8_t button_expander_num(); // expander buttons running, id from button_num()
+bool button_expander_ok();
+
+/* Chatter statistics, bounce width histogram buckets end at these (us) */
+#define BUTTON_BOUNCE_BOUNDS { 100, 250, 500, 1000, 2000, 3000, 5000 }
+#define BUTTON_BOUNCE_HIST_NUM 8
+#define BUTTON_TUNE_MIN_FLIPS 20
+
+typedef struct {
+    uint32_t flips;
+    uint32_t bounces;
+    uint32_t max_bounce_us;
+    uint32_t min_press_us;
+    uint32_t hist[BUTTON_BOUNCE_HIST_NUM];
+} button_stat_t;
+
+const button_stat_t *button_stat(int id);
+void button_stat_reset();
+uint32_t button_ring_overruns(); // PIO sampler/expander reads that fell a ring behind
+uint32_t button_freeze_us(int id);
+uint32_t button_freeze_suggest(int id);
+
+/* Freeze at least this many 1ms samples, also the analog averaging window,
+   0: back to config */
+#define BUTTON_SAMPLING_MAX 32
+void button_set_sampling(uint8_t count);
+
+/* Edge capture mode keeps recent edge timestamps (time_us_64) per button */
+uint32_t button_edge_count(int id);
+uint64_t button_edge_time(int id, int back); // back = 0 is the latest
+
 #endif
@@ -0,0 +1,102 @@
+/*
+ * Buffered CDC Transmit
+ * WHowe <github.com/whowechina>
+ *
+ * Every flush may end up as a short USB packet, so writers don't flush
+ * frame by frame anymore. A frame (escaping and all) is built in the
+ * port's buffer and committed with one write, then all frames of a tick
+ * share one flush. Each port is written by one task only, so there's no
+ * locking here.
+ */
+
+#include "cdc_tx.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "tusb.h"
+
+#include "usb_descriptors.h"
+#include "usbstat.h"
+
+static struct {
+    uint8_t buf[CDC_TX_FRAME_MAX];
+    uint16_t len;
+    bool unflushed;
+} tx[USB_PORT_NUM];
+
+void cdc_tx_end(int port)
+{
+    if ((port < 0) || (port >= USB_PORT_NUM) || (tx[port].len == 0)) {
+        return;
+    }
+
+    int itf = usb_cdc_itf(port);
+    if (itf >= 0) {
+        uint32_t written = tud_cdc_n_write(itf, tx[port].buf, tx[port].len);
+        usbstat_cdc_tx(port, tx[port].len, written);
+        tx[port].unflushed = true;
+    }
+    tx[port].len = 0;
+}
+
+int cdc_tx_queued(int port)
+{
+    if ((port < 0) || (port >= USB_PORT_NUM)) {
+        return -1;
+    }
+    int itf = usb_cdc_itf(port);
+    if (itf < 0) {
+        return -1;
+    }
+    int fifo = CFG_TUD_CDC_TX_BUFSIZE - tud_cdc_n_write_available(itf);
+    return tx[port].len + fifo;
+}
+
+void cdc_tx_put(int port, uint8_t c)
+{
+    if ((port < 0) || (port >= USB_PORT_NUM)) {
+        return;
+    }
+    if (tx[port].len == CDC_TX_FRAME_MAX) {
+        cdc_tx_end(port);
+    }
+    tx[port].buf[tx[port].len++] = c;
+}
+
+void cdc_tx_write(int port, const void *data, int len)
+{
+    if ((port < 0) || (port >= USB_PORT_NUM)) {
+        return;
+    }
+
+    const uint8_t *pos = data;
+    while (len > 0) {
+        if (tx[port].len == CDC_TX_FRAME_MAX) {
+            cdc_tx_end(port);
+        }
+        int room = CDC_TX_FRAME_MAX - tx[port].len;
+        int chunk = (len < room) ? len : room;
+        memcpy(tx[port].buf + tx[port].len, pos, chunk);
+        tx[port].len += chunk;
+        pos += chunk;
+        len -= chunk;
+    }
+}
+
+void cdc_tx_flush(int port)
+{
+    if ((port < 0) || (port >= USB_PORT_NUM)) {
+        return;
+    }
+
+    cdc_tx_end(port);
+    if (!tx[port].unflushed) {
+        return;
+    }
+    tx[port].unflushed = false;
+    int itf = usb_cdc_itf(port);
+    if (itf >= 0) {
+        tud_cdc_n_write_flush(itf);
+    }
+}
@@ -0,0 +1,23 @@
+/*
+ * Buffered CDC Transmit
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef CDC_TX_H
+#define CDC_TX_H
+
+#include <stdint.h>
+
+#define CDC_TX_FRAME_MAX 128 // a longer frame goes out in pieces
+
+/* Each port has one writer, frames are built then committed in one write */
+void cdc_tx_put(int port, uint8_t c);
+void cdc_tx_write(int port, const void *data, int len);
+void cdc_tx_end(int port); // frame complete, hand it to the stack
+int cdc_tx_queued(int port); // bytes not taken by the host yet, -1: no port
+
+/* Commits what's left and flushes once for every frame since last time,
+   the writer calls it at the end of its tick */
+void cdc_tx_flush(int port);
+
+#endif
@@ -41,19 +41,19 @@ void cli_register(const char *cmd, cmd_handler_t handler, const char *help)
 int cli_match_prefix(const char *str[], int num, const char *prefix)
 {
     int match = -1;
-    bool found = false;
+    bool ambiguous = false;
 
     for (int i = 0; (i < num) && str[i]; i++) {
         if (strncasecmp(str[i], prefix, strlen(prefix)) == 0) {
-            if (found) {
-                return -2;
+            if (strlen(str[i]) == strlen(prefix)) {
+                return i; // a full name wins over longer ones it prefixes
             }
-            found = true;
+            ambiguous = (match >= 0);
             match = i;
         }
     }
 
-    return match;
+    return ambiguous ? -2 : match;
 }
 
 const char *built_time = __DATE__ " " __TIME__;
@@ -11,8 +11,15 @@
 
 #include "mpr121.h"
 #include "touch.h"
+#include "analog.h"
 #include "button.h"
 #include "config.h"
+#include "event.h"
+#include "usb_descriptors.h"
+#include "hid.h"
+#include "sof.h"
+#include "telemetry.h"
+#include "usbstat.h"
 #include "save.h"
 #include "cli.h"
 
@@ -63,6 +70,18 @@ static void disp_hid()
     const char *nkro[] = {"off", "key1", "key2"};
     printf("  Joy: %s, NKRO: %s\n", mai_cfg->hid.joy ? "ON" : "OFF",
            mai_cfg->hid.nkro <= 2 ? nkro[mai_cfg->hid.nkro] : "key1");
+    if (mai_cfg->report.keepalive) {
+        printf("  Unchanged reports: held back, keepalive %d ms\n",
+               mai_cfg->report.keepalive);
+    } else {
+        printf("  Unchanged reports: always sent\n");
+    }
+    printf("  Touch in joy report: %s\n", mai_cfg->report.touch ? "ON" : "OFF");
+    printf("  Time stamps: %s\n", mai_cfg->report.stamp ? "ON" : "OFF");
+    if (hid_io4_timeout() || hid_io4_sampling()) {
+        printf("  IO4 host: timeout %d ms, sampling %d\n",
+               hid_io4_timeout(), hid_io4_sampling());
+    }
     if (mai_runtime.key_stuck) {
         printf("  !!! Button stuck, force JOY only !!!\n");
     }
@@ -113,17 +132,127 @@ static void disp_tweak()
            mai_cfg->tweak.aux_button_active_high ? "ON" : "OFF");
 }
 
+static void disp_button()
+{
+    printf("[Button]\n");
+    const char *modes[] = { "poll", "capture", "pio" };
+    printf("  Mode: %s\n", modes[mai_cfg->button.mode]);
+    if (button_mode() != mai_cfg->button.mode) {
+        printf("  !!! Not available, falling back to %s !!!\n", modes[button_mode()]);
+    }
+    printf("  Latch:");
+    for (int i = 0; i < button_num(); i++) {
+        if (mai_cfg->latch.buttons & (1 << i)) {
+            printf(" %d", i + 1);
+        }
+    }
+    printf("%s, %d frame(s)\n", mai_cfg->latch.buttons ? "" : " none",
+           mai_cfg->latch.frames);
+    printf("  Freeze (us):");
+    for (int i = 0; i < button_num(); i++) {
+        printf(" %lu%s", button_freeze_us(i),
+               mai_cfg->button.freeze[i] ? "" : "*");
+    }
+    printf("\n");
+    if (mai_cfg->expander.bits) {
+        printf("  Expander: %d inputs, active-%s, buttons %d..%d\n",
+               mai_cfg->expander.bits, mai_cfg->expander.active_high ? "high" : "low",
+               button_num() + 1, button_num() + mai_cfg->expander.bits);
+        if (!button_expander_ok()) {
+            printf("  !!! Pin or PIO/DMA resource conflict, expander is off !!!\n");
+        }
+    } else {
+        printf("  Expander: OFF\n");
+    }
+    if (button_ring_overruns()) {
+        printf("  PIO ring overruns: %lu\n", button_ring_overruns());
+    }
+}
+
+static void disp_analog()
+{
+    printf("[Analog]\n");
+    if (!analog_ok()) {
+        printf("  !!! No DMA channel left, analog buttons are off !!!\n");
+    }
+    if (!mai_cfg->analog.buttons) {
+        printf("  No analog buttons.\n");
+    }
+    for (int i = 0; i < button_num(); i++) {
+        if (!(mai_cfg->analog.buttons & (1 << i))) {
+            continue;
+        }
+        printf("  Button %2d (GPIO %2d): actuation %d, rapid trigger ", i + 1,
+               button_real_gpio(i), mai_cfg->analog.actuation[i] ?
+               mai_cfg->analog.actuation[i] : ANALOG_ACTUATION_DEFAULT);
+        if (mai_cfg->analog.press[i] || mai_cfg->analog.release[i]) {
+            printf("%d/%d", mai_cfg->analog.press[i], mai_cfg->analog.release[i]);
+        } else {
+            printf("OFF");
+        }
+        if (!analog_info(i)) {
+            printf(" (not an ADC pin)");
+        }
+        printf("\n");
+    }
+}
+
+static void disp_delay()
+{
+    printf("[Delay]\n");
+    printf("  Button: %d ms, Touch: %d ms, NKRO: %d ms\n",
+           mai_cfg->delay.button, mai_cfg->delay.touch, mai_cfg->delay.nkro);
+}
+
+static void disp_usb()
+{
+    printf("[USB]\n");
+    printf("  Profile: %s", usb_profile_name(mai_cfg->usb.profile));
+    if (usb_profile() != mai_cfg->usb.profile) {
+        printf(" (running %s)", usb_profile_name(usb_profile()));
+    }
+    printf("\n");
+}
+
+static void disp_serial()
+{
+    printf("[Serial Touch]\n");
+    printf("  Latest wins: %s\n", mai_cfg->serial.latest ? "ON" : "OFF");
+    if (mai_cfg->serial.on_change) {
+        printf("  On change: ON, min gap %d us, keepalive %d ms\n",
+               mai_cfg->serial.min_gap_us,
+               mai_cfg->serial.keepalive ? mai_cfg->serial.keepalive : 1);
+    } else {
+        printf("  On change: OFF, every 1 ms\n");
+    }
+#ifdef AZAMAI_BUILD
+    printf("  (bridged from the touch board, settings unused)\n");
+#else
+    printf("  (touch is read once per 1 ms frame, min gap under 1000 us has no effect)\n");
+#endif
+}
+
+static void disp_sof()
+{
+    printf("[SOF Sync]\n");
+    if (mai_cfg->sof.offset_us) {
+        printf("  Sample %d us before SOF.\n", mai_cfg->sof.offset_us);
+    } else {
+        printf("  OFF, free running.\n");
+    }
+}
+
 #define ARRAYSIZE(x) (sizeof(x) / sizeof(x[0]))
 
 void handle_display(int argc, char *argv[])
 {
-    const char *usage = "Usage: display [rgb|sense|hid|gpio|touch|aime|tweak]\n";
+    const char *usage = "Usage: display [rgb|sense|hid|gpio|touch|aime|tweak|button|delay|analog|sof|usb|serial]\n";
     if (argc > 1) {
         printf(usage);
         return;
     }
 
-    const char *choices[] = {"rgb", "sense", "hid", "gpio", "touch", "aime", "tweak"};
+    const char *choices[] = {"rgb", "sense", "hid", "gpio", "touch", "aime", "tweak", "button", "delay", "analog", "sof", "usb", "serial"};
     static void (*disp_funcs[])() = {
         disp_rgb,
         disp_sense,
@@ -132,6 +261,12 @@ void handle_display(int argc, char *argv[])
         disp_touch,
         disp_aime,
         disp_tweak,
+        disp_button,
+        disp_delay,
+        disp_analog,
+        disp_sof,
+        disp_usb,
+        disp_serial,
     };
   
     static_assert(ARRAYSIZE(choices) == ARRAYSIZE(disp_funcs),
@@ -199,8 +334,69 @@ static void handle_level(int argc, char *argv[])
     disp_rgb();
 }
 
+static void stat_buttons()
+{
+    const uint16_t bounds[] = BUTTON_BOUNCE_BOUNDS;
+    printf("       flips bounces  max_us  min_press|");
+    for (int i = 0; i < BUTTON_BOUNCE_HIST_NUM - 1; i++) {
+        printf("<%5u|", bounds[i]);
+    }
+    printf(" more | suggest\n");
+
+    for (int i = 0; i < button_num() + button_expander_num(); i++) {
+        const button_stat_t *stat = button_stat(i);
+        printf("  %2d: %6lu %7lu %7lu %10lu|", i + 1, stat->flips,
+               stat->bounces, stat->max_bounce_us, stat->min_press_us);
+        for (int j = 0; j < BUTTON_BOUNCE_HIST_NUM; j++) {
+            printf("%6lu|", stat->hist[j]);
+        }
+        uint32_t suggest = button_freeze_suggest(i);
+        if (suggest) {
+            printf(" %lu\n", suggest);
+        } else {
+            printf(" -\n");
+        }
+    }
+}
+
+static void stat_hid()
+{
+    const char *names[] = { "Joy", "NKRO" };
+    for (int i = 0; i < 2; i++) {
+        const hid_stat_t *stat = hid_stat(i);
+        printf("  %-4s: %lu sent, %lu suppressed, %lu replaced\n", names[i],
+               stat->sent, stat->suppressed, stat->replaced);
+    }
+}
+
 static void handle_stat(int argc, char *argv[])
 {
+    if ((argc >= 1) &&
+        (strncasecmp(argv[0], "hid", strlen(argv[0])) == 0)) {
+        if (argc == 1) {
+            stat_hid();
+        } else if ((argc == 2) &&
+                   (strncasecmp(argv[1], "reset", strlen(argv[1])) == 0)) {
+            hid_reset_stat();
+        } else {
+            printf("Usage: stat hid [reset]\n");
+        }
+        return;
+    }
+
+    if ((argc >= 1) &&
+        (strncasecmp(argv[0], "buttons", strlen(argv[0])) == 0)) {
+        if (argc == 1) {
+            stat_buttons();
+        } else if ((argc == 2) &&
+                   (strncasecmp(argv[1], "reset", strlen(argv[1])) == 0)) {
+            button_stat_reset();
+        } else {
+            printf("Usage: stat buttons [reset]\n");
+        }
+        return;
+    }
+
 #ifndef AZAMAI_BUILD
     if (argc == 0) {
         for (int col = 0; col < 4; col++) {
@@ -218,14 +414,63 @@ static void handle_stat(int argc, char *argv[])
                (strncasecmp(argv[0], "reset", strlen(argv[0])) == 0)) {
         touch_reset_stat();
     } else {
-        printf("Usage: stat [reset]\n");
+        printf("Usage: stat [reset]\n"
+               "       stat buttons [reset]\n"
+               "       stat hid [reset]\n");
     }
+#else
+    printf("Usage: stat buttons [reset]\n"
+           "       stat hid [reset]\n");
 #endif
 }
 
 static void handle_hid(int argc, char *argv[])
 {
-    const char *usage = "Usage: hid <joy|key1|key2>\n";
+    const char *usage = "Usage: hid <joy|key1|key2>\n"
+                        "       hid keepalive <ms>\n"
+                        "       hid touch <on|off>\n"
+                        "       hid stamp <on|off>\n"
+                        "  ms: 0..255, 0 sends every report even if unchanged\n"
+                        "  stamp: device time and sequence in the IO4 report\n"
+                        "         and in serial touch frames, see clock\n";
+    if ((argc == 2) &&
+        (strncasecmp(argv[0], "touch", strlen(argv[0])) == 0)) {
+        const char *onoff[] = { "off", "on" };
+        int on = cli_match_prefix(onoff, 2, argv[1]);
+        if (on < 0) {
+            printf(usage);
+            return;
+        }
+        mai_cfg->report.touch = on;
+        config_changed();
+        disp_hid();
+        return;
+    }
+    if ((argc == 2) &&
+        (strncasecmp(argv[0], "stamp", strlen(argv[0])) == 0)) {
+        const char *onoff[] = { "off", "on" };
+        int on = cli_match_prefix(onoff, 2, argv[1]);
+        if (on < 0) {
+            printf(usage);
+            return;
+        }
+        mai_cfg->report.stamp = on;
+        config_changed();
+        disp_hid();
+        return;
+    }
+    if ((argc == 2) &&
+        (strncasecmp(argv[0], "keepalive", strlen(argv[0])) == 0)) {
+        int ms = cli_extract_non_neg_int(argv[1], 0);
+        if ((ms < 0) || (ms > 255)) {
+            printf(usage);
+            return;
+        }
+        mai_cfg->report.keepalive = ms;
+        config_changed();
+        disp_hid();
+        return;
+    }
     if (argc != 1) {
         printf(usage);
         return;
@@ -256,6 +501,10 @@ static void handle_hid(int argc, char *argv[])
     }
     config_changed();
     disp_hid();
+    if (mai_cfg->hid.nkro && !usb_has_nkro()) {
+        printf("  Warning: profile %s has no NKRO keyboard, try \"usb service\".\n",
+               usb_profile_name(usb_profile()));
+    }
 }
 
 static void handle_filter(int argc, char *argv[])
@@ -439,8 +688,12 @@ static void handle_whoami()
 {
     const char *msg[] = {"\nThis is Command Line port.\n", "\nThis is Touch port.\n", "\nThis is LED port.\n"};
     for (int i = 0; i < 3; i++) {
-        tud_cdc_n_write(i, msg[i], strlen(msg[i]));
-        tud_cdc_n_write_flush(i);
+        int itf = usb_cdc_itf(i);
+        if (itf < 0) {
+            continue;
+        }
+        tud_cdc_n_write(itf, msg[i], strlen(msg[i]));
+        tud_cdc_n_write_flush(itf);
     }
 }
 
@@ -567,6 +820,124 @@ static void handle_touch(int argc, char *argv[])
 }
 
 
+static const struct {
+    char name;
+    uint8_t first;
+    uint8_t num;
+} zone_groups[] = { { 'A', A1, 8 }, { 'B', B1, 8 }, { 'C', C1, 2 },
+                    { 'D', D1, 8 }, { 'E', E1, 8 } };
+
+static int zone_by_name(const char *name)
+{
+    if (strlen(name) != 2) {
+        return -1;
+    }
+    for (int i = 0; i < ARRAYSIZE(zone_groups); i++) {
+        int index = name[1] - '1';
+        if ((toupper(name[0]) == zone_groups[i].name) &&
+            (index >= 0) && (index < zone_groups[i].num)) {
+            return zone_groups[i].first + index;
+        }
+    }
+    return -1;
+}
+
+static void zone_name(int zone, char *name)
+{
+    for (int i = ARRAYSIZE(zone_groups) - 1; i >= 0; i--) {
+        if (zone >= zone_groups[i].first) {
+            name[0] = zone_groups[i].name;
+            name[1] = '1' + zone - zone_groups[i].first;
+            name[2] = 0;
+            return;
+        }
+    }
+}
+
+/* a..z and 0..9 by name, anything else by its usage number */
+static int key_usage(const char *key)
+{
+    if (strcasecmp(key, "off") == 0) {
+        return 0;
+    }
+    if (strlen(key) == 1) {
+        char ch = tolower(key[0]);
+        if ((ch >= 'a') && (ch <= 'z')) {
+            return 0x04 + ch - 'a';
+        }
+        if ((ch >= '1') && (ch <= '9')) {
+            return 0x1e + ch - '1';
+        }
+        if (ch == '0') {
+            return 0x27;
+        }
+        return -1;
+    }
+    int code = cli_extract_non_neg_int(key, 0);
+    if ((code < 4) || (code >= NKRO_KEY_MAX)) {
+        return -1;
+    }
+    return code;
+}
+
+static void disp_touchkey()
+{
+    printf("[Touch Keys]\n");
+    int count = 0;
+    for (int i = 0; i < 34; i++) {
+        if (!mai_cfg->nkro.touch[i]) {
+            continue;
+        }
+        char name[3];
+        zone_name(i, name);
+        printf("  %s: 0x%02x%s", name, mai_cfg->nkro.touch[i],
+               (++count % 6) ? "" : "\n");
+    }
+    if (!count) {
+        printf("  None, touch is not in NKRO reports.");
+    }
+    printf("\n");
+}
+
+static void handle_touchkey(int argc, char *argv[])
+{
+    const char *usage = "Usage: touchkey <zone|all> <key|off>\n"
+                        "  zone: A1..A8, B1..B8, C1, C2, D1..D8, E1..E8\n"
+                        "   key: a..z, 0..9, or a HID usage number 4..119\n";
+    if (argc == 0) {
+        disp_touchkey();
+        return;
+    }
+    if (argc != 2) {
+        printf(usage);
+        return;
+    }
+
+    int code = key_usage(argv[1]);
+    if (code < 0) {
+        printf(usage);
+        return;
+    }
+
+    if (strcasecmp(argv[0], "all") == 0) {
+        if (code != 0) {
+            printf("Only \"all off\" makes sense.\n");
+            return;
+        }
+        memset(mai_cfg->nkro.touch, 0, sizeof(mai_cfg->nkro.touch));
+    } else {
+        int zone = zone_by_name(argv[0]);
+        if (zone < 0) {
+            printf(usage);
+            return;
+        }
+        mai_cfg->nkro.touch[zone] = code;
+    }
+
+    config_changed();
+    disp_touchkey();
+}
+
 static bool handle_aime_mode(const char *mode)
 {
     if (strcmp(mode, "0") == 0) {
@@ -655,9 +1026,602 @@ static void handle_tweak(int argc, char *argv[])
     }
 
     config_changed();
+    button_init(); // Active levels are cached by the buttons
     disp_tweak();
 }
 
+static void button_edges()
+{
+    uint64_t now = time_us_64();
+    for (int i = 0; i < button_num(); i++) {
+        uint32_t count = button_edge_count(i);
+        printf("  %2d: %6lu edges", i + 1, count);
+        if (count > 0) {
+            printf(", %llu us ago, gaps:", now - button_edge_time(i, 0));
+            for (int j = 1; j < 4; j++) {
+                uint64_t newer = button_edge_time(i, j - 1);
+                uint64_t older = button_edge_time(i, j);
+                if (!older) {
+                    break;
+                }
+                printf(" %llu", newer - older);
+            }
+        }
+        printf("\n");
+    }
+}
+
+static bool button_latch(int argc, char *argv[])
+{
+    if (argc != 2) {
+        return false;
+    }
+
+    if (strcasecmp(argv[0], "frames") == 0) {
+        int frames = cli_extract_non_neg_int(argv[1], 0);
+        if ((frames < 1) || (frames > 16)) {
+            return false;
+        }
+        mai_cfg->latch.frames = frames;
+        return true;
+    }
+
+    const char *switches[] = { "on", "off" };
+    int on_off = cli_match_prefix(switches, 2, argv[1]);
+    if (on_off < 0) {
+        return false;
+    }
+
+    uint16_t mask;
+    const char *groups[] = { "all", "main", "aux" };
+    int group = cli_match_prefix(groups, 3, argv[0]);
+    if (group == 0) {
+        mask = (1 << button_num()) - 1;
+    } else if (group == 1) {
+        mask = 0x00ff;
+    } else if (group == 2) {
+        mask = ((1 << button_num()) - 1) & ~0x00ff;
+    } else {
+        int id = cli_extract_non_neg_int(argv[0], 0);
+        if ((id < 1) || (id > button_num())) {
+            return false;
+        }
+        mask = 1 << (id - 1);
+    }
+
+    if (on_off == 0) {
+        mai_cfg->latch.buttons |= mask;
+    } else {
+        mai_cfg->latch.buttons &= ~mask;
+    }
+    return true;
+}
+
+static bool button_freeze(int argc, char *argv[])
+{
+    if (argc != 2) {
+        return false;
+    }
+
+    int first = 0;
+    int last = button_num() - 1;
+    if (strncasecmp(argv[0], "all", strlen(argv[0])) != 0) {
+        int id = cli_extract_non_neg_int(argv[0], 0);
+        if ((id < 1) || (id > button_num())) {
+            return false;
+        }
+        first = last = id - 1;
+    }
+
+    const char *choices[] = { "auto", "default" };
+    int choice = cli_match_prefix(choices, 2, argv[1]);
+    int us = 0;
+    if (choice < 0) {
+        us = cli_extract_non_neg_int(argv[1], 0);
+        if ((us < 100) || (us > 25500)) {
+            return false;
+        }
+    }
+
+    for (int i = first; i <= last; i++) {
+        if (choice == 0) {
+            uint32_t suggest = button_freeze_suggest(i);
+            if (!suggest) {
+                printf("Button %d: not enough data, try \"stat buttons\".\n", i + 1);
+                continue;
+            }
+            mai_cfg->button.freeze[i] = suggest / 100;
+        } else if (choice == 1) {
+            mai_cfg->button.freeze[i] = 0;
+        } else {
+            mai_cfg->button.freeze[i] = (us + 50) / 100;
+        }
+    }
+    return true;
+}
+
+static bool button_expander(int argc, char *argv[])
+{
+    if ((argc < 1) || (argc > 2)) {
+        return false;
+    }
+
+    if (strncasecmp(argv[0], "off", strlen(argv[0])) == 0) {
+        mai_cfg->expander.bits = 0;
+        return argc == 1;
+    }
+
+    int bits = cli_extract_non_neg_int(argv[0], 0);
+    if ((bits < 1) || (bits > BUTTON_MAX - button_num())) {
+        return false;
+    }
+    mai_cfg->expander.bits = bits;
+
+    if (argc == 2) {
+        const char *levels[] = { "low", "high" };
+        int level = cli_match_prefix(levels, 2, argv[1]);
+        if (level < 0) {
+            return false;
+        }
+        mai_cfg->expander.active_high = level;
+    }
+    return true;
+}
+
+static void handle_button(int argc, char *argv[])
+{
+    const char *usage = "Usage: button mode <poll|capture|pio>\n"
+                        "       button edges\n"
+                        "       button latch <all|main|aux|1..12> <on|off>\n"
+                        "       button latch frames <1..16>\n"
+                        "       button freeze <all|1..12> <us|auto|default>\n"
+                        "       button expander <off|1..20> [low|high]\n";
+    const char *commands[] = { "mode", "edges", "latch", "freeze", "expander" };
+    int match = (argc > 0) ? cli_match_prefix(commands, 5, argv[0]) : -1;
+
+    if (match == 4) {
+        if (!button_expander(argc - 1, argv + 1)) {
+            printf(usage);
+            return;
+        }
+        config_changed();
+        button_init();
+        disp_button();
+        return;
+    }
+
+    if (match == 3) {
+        if (!button_freeze(argc - 1, argv + 1)) {
+            printf(usage);
+            return;
+        }
+        config_changed();
+        button_init();
+        disp_button();
+        return;
+    }
+
+    if ((match == 1) && (argc == 1)) {
+        button_edges();
+        return;
+    }
+
+    if (match == 2) {
+        if (!button_latch(argc - 1, argv + 1)) {
+            printf(usage);
+            return;
+        }
+        config_changed();
+        disp_button();
+        return;
+    }
+
+    if ((match != 0) || (argc != 2)) {
+        printf(usage);
+        return;
+    }
+
+    const char *modes[] = { "poll", "capture", "pio" };
+    int mode = cli_match_prefix(modes, 3, argv[1]);
+    if (mode < 0) {
+        printf(usage);
+        return;
+    }
+
+    mai_cfg->button.mode = mode;
+    config_changed();
+    button_init();
+    disp_button();
+}
+
+static void handle_delay(int argc, char *argv[])
+{
+    const char *usage = "Usage: delay <button|touch|nkro> <ms>\n"
+                        "  button: IO4 buttons, touch: serial touch stream,\n"
+                        "  nkro: NKRO buttons and touch keys\n"
+                        "  ms: 0..63\n";
+    if (argc != 2) {
+        printf(usage);
+        return;
+    }
+
+    const char *paths[] = { "button", "touch", "nkro" };
+    int path = cli_match_prefix(paths, 3, argv[0]);
+    int ms = cli_extract_non_neg_int(argv[1], 0);
+    if ((path < 0) || (ms < 0) || (ms > 63)) {
+        printf(usage);
+        return;
+    }
+
+    if (path == 0) {
+        mai_cfg->delay.button = ms;
+    } else if (path == 1) {
+        mai_cfg->delay.touch = ms;
+    } else {
+        mai_cfg->delay.nkro = ms;
+    }
+
+    config_changed();
+    disp_delay();
+}
+
+static void analog_show()
+{
+    printf("  Button |  raw | rest | range | travel\n");
+    for (int i = 0; i < button_num(); i++) {
+        const analog_info_t *info = analog_info(i);
+        if (!info) {
+            continue;
+        }
+        printf("     %2d | %4d | %4d | %5d | %3d %s\n", i + 1, info->raw,
+               info->rest, info->range, info->travel, info->pressed ? "*" : "");
+    }
+}
+
+static bool analog_set(int argc, char *argv[])
+{
+    if (argc < 2) {
+        return false;
+    }
+
+    int first = 0;
+    int last = button_num() - 1;
+    if (strncasecmp(argv[0], "all", strlen(argv[0])) != 0) {
+        int id = cli_extract_non_neg_int(argv[0], 0);
+        if ((id < 1) || (id > button_num())) {
+            return false;
+        }
+        first = last = id - 1;
+    }
+
+    const char *options[] = { "on", "off", "actuation", "rt" };
+    int option = cli_match_prefix(options, 4, argv[1]);
+    int value[2] = { 0 };
+
+    if (((option == 0) || (option == 1)) && (argc == 2)) {
+        for (int i = first; i <= last; i++) {
+            uint8_t gpio = button_real_gpio(i);
+            if ((option == 0) && ((gpio < ANALOG_GPIO_BASE) ||
+                                  (gpio >= ANALOG_GPIO_BASE + ANALOG_CHANNELS))) {
+                if (first == last) {
+                    printf("Button %d is on GPIO %d, not an ADC pin.\n", i + 1, gpio);
+                }
+                continue;
+            }
+            if (option == 0) {
+                mai_cfg->analog.buttons |= 1 << i;
+            } else {
+                mai_cfg->analog.buttons &= ~(1 << i);
+            }
+        }
+        return true;
+    }
+
+    if ((option == 2) && (argc == 3)) {
+        if (strncasecmp(argv[2], "default", strlen(argv[2])) != 0) {
+            value[0] = cli_extract_non_neg_int(argv[2], 0);
+            if ((value[0] < 1) || (value[0] > 255)) {
+                return false;
+            }
+        }
+        for (int i = first; i <= last; i++) {
+            mai_cfg->analog.actuation[i] = value[0];
+        }
+        return true;
+    }
+
+    if ((option == 3) && (argc == 4)) {
+        value[0] = cli_extract_non_neg_int(argv[2], 0);
+        value[1] = cli_extract_non_neg_int(argv[3], 0);
+        if ((value[0] < 0) || (value[0] > 255) ||
+            (value[1] < 0) || (value[1] > 255)) {
+            return false;
+        }
+        for (int i = first; i <= last; i++) {
+            mai_cfg->analog.press[i] = value[0];
+            mai_cfg->analog.release[i] = value[1];
+        }
+        return true;
+    }
+
+    return false;
+}
+
+static void handle_analog(int argc, char *argv[])
+{
+    const char *usage = "Usage: analog\n"
+                        "       analog calibrate\n"
+                        "       analog <all|1..12> <on|off>\n"
+                        "       analog <all|1..12> actuation <1..255|default>\n"
+                        "       analog <all|1..12> rt <press> <release>\n"
+                        "  travel is 0 (rest) to 255 (bottom), rt 0 0 turns off rapid trigger\n";
+
+    if (argc == 0) {
+        analog_show();
+        return;
+    }
+
+    if ((argc == 1) &&
+        (strncasecmp(argv[0], "calibrate", strlen(argv[0])) == 0)) {
+        analog_calibrate();
+        printf("Release all analog buttons, rest is taken from the next reading.\n");
+        return;
+    }
+
+    if (!analog_set(argc, argv)) {
+        printf(usage);
+        return;
+    }
+
+    config_changed();
+    button_init();
+    disp_analog();
+}
+
+static void handle_event(int argc, char *argv[])
+{
+    if ((argc == 1) &&
+        (strncasecmp(argv[0], "reset", strlen(argv[0])) == 0)) {
+        event_reset_stat();
+        return;
+    }
+    if (argc != 0) {
+        printf("Usage: event [reset]\n");
+        return;
+    }
+
+    const char *sources[] = { "button", "touch", "uart touch" };
+    printf("[Published]\n");
+    for (int i = 0; i < EVENT_SOURCE_NUM; i++) {
+        printf("  %-10s: %lu\n", sources[i], event_published(i));
+    }
+    printf("[Consumers]\n");
+    for (int i = 0; i < event_sub_num(); i++) {
+        const event_sub_t *sub = event_sub(i);
+        uint32_t avg = sub->count ? sub->latency_sum / sub->count : 0;
+        printf("  %-10s: %lu read, %lu missed, latency avg %lu us, max %lu us\n",
+               sub->name, sub->count, sub->missed, avg, sub->latency_max);
+    }
+}
+
+static void sof_show()
+{
+    const sof_stat_t *stat = sof_stat();
+    printf("  %s, host frame period %lu.%03lu us\n",
+           stat->locked ? "Locked" : "Not locked",
+           stat->period_ns / 1000, stat->period_ns % 1000);
+    printf("  SOFs: %lu, resyncs: %lu, timestamp late avg %lu us, max %lu us\n",
+           stat->frames, stat->resyncs,
+           stat->frames ? (uint32_t)(stat->late_sum / stat->frames) : 0,
+           stat->late_max);
+    if (stat->unlatched) {
+        printf("  SOFs timed from tud_task: %lu\n", stat->unlatched);
+    }
+    if (stat->runs) {
+        printf("  Rounds: %lu, started %ld us before SOF, jitter %ld us (%ld..%ld)\n",
+               stat->runs, (int32_t)(stat->phase_sum / stat->runs),
+               stat->phase_max - stat->phase_min, stat->phase_min, stat->phase_max);
+    } else {
+        printf("  No synchronized rounds yet.\n");
+    }
+}
+
+static void handle_sof(int argc, char *argv[])
+{
+    const char *usage = "Usage: sof [offset <us>|reset]\n"
+                        "  us: 0 (off) or 50..900, sampling lead before SOF\n";
+    if (argc == 0) {
+        disp_sof();
+        sof_show();
+        return;
+    }
+
+    const char *commands[] = { "offset", "reset" };
+    int cmd = cli_match_prefix(commands, 2, argv[0]);
+    if ((cmd == 1) && (argc == 1)) {
+        sof_reset_stat();
+        return;
+    }
+    if ((cmd != 0) || (argc != 2)) {
+        printf(usage);
+        return;
+    }
+
+    int us = cli_extract_non_neg_int(argv[1], 0);
+    if ((us < 0) || (us > SOF_OFFSET_MAX) || ((us > 0) && (us < 50))) {
+        printf(usage);
+        return;
+    }
+
+    mai_cfg->sof.offset_us = us;
+    config_changed();
+    disp_sof();
+}
+
+static void handle_serial(int argc, char *argv[])
+{
+    const char *usage = "Usage: serial latest <on|off>\n"
+                        "       serial change <on|off>\n"
+                        "       serial gap <us>\n"
+                        "       serial keepalive <ms>\n"
+                        "  latest: drop touch frames while the host is behind,\n"
+                        "          so it always reads the newest touch state\n"
+                        "  change: send as soon as the touch changes, at most\n"
+                        "          every <us> (0..1000), at least every <ms> (1..100)\n"
+                        "          touch is read once per 1 ms frame, so a gap\n"
+                        "          under 1000 us has no effect\n";
+    if (argc == 0) {
+        disp_serial();
+        return;
+    }
+    if (argc != 2) {
+        printf(usage);
+        return;
+    }
+
+    const char *options[] = { "latest", "change", "gap", "keepalive" };
+    int option = cli_match_prefix(options, 4, argv[0]);
+    if (option < 2) {
+        const char *onoff[] = { "off", "on" };
+        int on = cli_match_prefix(onoff, 2, argv[1]);
+        if ((option < 0) || (on < 0)) {
+            printf(usage);
+            return;
+        }
+        if (option == 0) {
+            mai_cfg->serial.latest = on;
+        } else {
+            mai_cfg->serial.on_change = on;
+        }
+    } else {
+        int value = cli_extract_non_neg_int(argv[1], 0);
+        if ((option == 2) && (value >= 0) && (value <= SERIAL_MIN_GAP_MAX)) {
+            mai_cfg->serial.min_gap_us = value;
+        } else if ((option == 3) && (value >= 1) && (value <= SERIAL_KEEPALIVE_MAX)) {
+            mai_cfg->serial.keepalive = value;
+        } else {
+            printf(usage);
+            return;
+        }
+    }
+
+    config_changed();
+    disp_serial();
+}
+
+static void handle_usbstat(int argc, char *argv[])
+{
+    if ((argc == 1) && (strncasecmp(argv[0], "reset", strlen(argv[0])) == 0)) {
+        usbstat_reset();
+        return;
+    }
+    if (argc != 0) {
+        printf("Usage: usbstat [reset]\n");
+        return;
+    }
+
+    const uint16_t bounds[] = USBSTAT_GAP_BOUNDS;
+    printf("[USB HID] report interval (us)\n");
+    printf("         sent    busy  failed  max_gap|");
+    for (int i = 0; i < USBSTAT_GAP_HIST_NUM - 1; i++) {
+        printf("<%5u|", bounds[i]);
+    }
+    printf(" more\n");
+
+    const char *hid_names[] = { "Joy", "NKRO" };
+    for (int i = 0; i < 2; i++) {
+        const usbstat_hid_t *stat = usbstat_hid(i);
+        printf("  %-4s: %7lu %7lu %7lu %8lu|", hid_names[i], stat->sent,
+               stat->busy, stat->failed, stat->max_gap_us);
+        for (int j = 0; j < USBSTAT_GAP_HIST_NUM; j++) {
+            printf("%6lu|", stat->hist[j]);
+        }
+        printf("\n");
+    }
+
+    printf("[USB CDC]\n");
+    printf("          itf  rx_bytes  tx_bytes   writes  tx_full    stale\n");
+    const char *cdc_names[] = { "CLI", "Touch", "LED", "AIME" };
+    static_assert(ARRAYSIZE(cdc_names) == USB_PORT_NUM, "USB port names");
+    for (int i = 0; i < USB_PORT_NUM; i++) {
+        const usbstat_cdc_t *stat = usbstat_cdc(i);
+        int itf = usb_cdc_itf(i);
+        if (itf < 0) {
+            printf("  %-5s:   -", cdc_names[i]);
+        } else {
+            printf("  %-5s: %3d", cdc_names[i], itf);
+        }
+        if (i == USB_PORT_CLI) {
+            printf("  (stdio, not counted)\n");
+            continue;
+        }
+        printf(" %9lu %9lu %8lu %8lu %8lu\n", stat->rx_bytes, stat->tx_bytes,
+               stat->writes, stat->tx_full, stat->stale);
+    }
+}
+
+/*
+ * Clock sync: a host tool notes its own time around the request and maps
+ * the device time to the middle of that round trip. The token is echoed
+ * back so late replies can't be mistaken for the current one.
+ */
+static void handle_clock(int argc, char *argv[])
+{
+    if (argc > 1) {
+        printf("Usage: clock [token]\n"
+               "  Prints device time in us, report stamps use its low 32 bits.\n");
+        return;
+    }
+    uint64_t now = time_us_64();
+    printf("clock %s %llu\n", argc ? argv[0] : "-", now);
+}
+
+static void handle_usb(int argc, char *argv[])
+{
+    const char *usage = "Usage: usb <service|game|nfc>\n"
+                        "  service: every HID and CDC port\n"
+                        "     game: IO4, touch and LED ports only\n"
+                        "      nfc: IO4, touch, LED and AIME ports\n"
+                        "  Hold Service while plugging in to get every port back.\n";
+    if (argc == 0) {
+        disp_usb();
+        return;
+    }
+    if (argc != 1) {
+        printf(usage);
+        return;
+    }
+
+    const char *names[USB_PROFILE_NUM];
+    for (int i = 0; i < USB_PROFILE_NUM; i++) {
+        names[i] = usb_profile_name(i);
+    }
+    int profile = cli_match_prefix(names, USB_PROFILE_NUM, argv[0]);
+    if (profile < 0) {
+        printf(usage);
+        return;
+    }
+
+    mai_cfg->usb.profile = profile;
+    config_changed();
+    disp_usb();
+    if (profile != usb_profile()) {
+        printf("Re-enumerating...\n");
+        usb_profile_apply(profile);
+    }
+}
+
+static void handle_telemetry()
+{
+    const telemetry_stat_t *stat = telemetry_stat();
+    printf("[Telemetry]\n");
+    if (usb_profile() != USB_PROFILE_SERVICE) {
+        printf("  Only in the service USB profile.\n");
+    }
+    printf("  %s, %lu frames sent, %lu dropped\n",
+           stat->streaming ? "Streaming" : "Idle", stat->sent, stat->dropped);
+}
+
 void commands_init()
 {
     cli_register("display", handle_display, "Display all config.");
@@ -676,4 +1640,15 @@ void commands_init()
     cli_register("tweak", handle_tweak, "Miscellaneous tweak options.");
     cli_register("factory", config_factory_reset, "Reset everything to default.");
     cli_register("aime", handle_aime, "AIME settings.");
+    cli_register("button", handle_button, "Button capture settings.");
+    cli_register("delay", handle_delay, "Set input alignment delays.");
+    cli_register("analog", handle_analog, "Analog button settings.");
+    cli_register("event", handle_event, "Display input event bus statistics.");
+    cli_register("sof", handle_sof, "USB frame synchronized sampling.");
+    cli_register("touchkey", handle_touchkey, "Map touch zones to NKRO keys.");
+    cli_register("usb", handle_usb, "Select the USB interface profile.");
+    cli_register("serial", handle_serial, "Serial touch stream options.");
+    cli_register("usbstat", handle_usbstat, "Display or reset USB transport statistics.");
+    cli_register("clock", handle_clock, "Device time for host clock sync.");
+    cli_register("telemetry", handle_telemetry, "Display telemetry stream statistics.");
 }
@@ -8,11 +8,19 @@
 
 #include <string.h>
 
+#include "hardware/sync.h"
+
 #include "config.h"
 #include "save.h"
 #include "touch.h"
+#include "analog.h"
+#include "sof.h"
+#include "usb_descriptors.h"
+#include "board_defs.h"
 
 mai_cfg_t *mai_cfg;
+mai_hot_t mai_hot;
+static spin_lock_t *hot_lock;
 
 static mai_cfg_t default_cfg = {
     .color = {
@@ -62,6 +70,16 @@ static mai_cfg_t default_cfg = {
 #endif
         .aux_button_active_high = 0,
     },
+    .button = {
+        .mode = 0,
+    },
+    .latch = {
+        .buttons = 0,
+        .frames = 1,
+    },
+    .report = {
+        .keepalive = 8,
+    },
 };
 
 mai_runtime_t mai_runtime;
@@ -88,6 +106,90 @@ static bool touch_map_valid()
     return keys > 10; // bad data results in low touch key coverage
 }
 
+/* The table is built aside and copied in under hot_lock. That keeps out
+   tasks and IRQs on this core; core1 reads go under the same lock. */
+static void hot_rebuild()
+{
+    static mai_hot_t scratch;
+    mai_hot_t *hot = &scratch;
+    memset(hot, 0, sizeof(*hot));
+
+    hot->latch_buttons = mai_cfg->latch.buttons;
+    hot->latch_frames = mai_cfg->latch.frames;
+    hot->hid_joy = mai_cfg->hid.joy;
+    hot->hid_nkro = mai_cfg->hid.nkro;
+    hot->hid_keepalive = mai_cfg->report.keepalive;
+    hot->hid_touch = mai_cfg->report.touch;
+    hot->stamp = mai_cfg->report.stamp;
+    hot->serial_latest = mai_cfg->serial.latest;
+    hot->serial_on_change = mai_cfg->serial.on_change;
+    hot->serial_min_gap = mai_cfg->serial.min_gap_us;
+    uint8_t keepalive = mai_cfg->serial.on_change ? mai_cfg->serial.keepalive : 0;
+    hot->serial_keepalive = keepalive ? keepalive * 1000 : 1000;
+    hot->delay_button = mai_cfg->delay.button;
+    hot->delay_touch = mai_cfg->delay.touch;
+    hot->delay_nkro = mai_cfg->delay.nkro;
+    hot->sof_offset = mai_cfg->sof.offset_us;
+    hot->rgb_per[0] = mai_cfg->rgb.per_button;
+    hot->rgb_per[1] = mai_cfg->rgb.per_aux;
+
+    /* expander buttons (12..23) take the other player's keys */
+    static const char keymap_p1[] = BUTTON_NKRO_MAP_P1;
+    static const char keymap_p2[] = BUTTON_NKRO_MAP_P2;
+    const char *keymaps[2] = { keymap_p1, keymap_p2 };
+    bool p2 = (mai_cfg->hid.nkro == 2);
+    memset(hot->nkro_byte, 0xff, sizeof(hot->nkro_byte));
+    for (int i = 0; mai_cfg->hid.nkro && (i < 24); i++) {
+        uint8_t code = keymaps[(i < 12) ? p2 : !p2][i % 12];
+        hot->nkro_byte[i] = code / 8;
+        hot->nkro_bit[i] = 1 << (code % 8);
+    }
+
+    /* any touch map is the OR of 9 table lookups, one for each nibble */
+    memset(hot->nkro_touch, 0, sizeof(hot->nkro_touch));
+    memset(hot->nkro_touch_all, 0, sizeof(hot->nkro_touch_all));
+    for (int key = 0; mai_cfg->hid.nkro && (key < 34); key++) {
+        uint8_t code = mai_cfg->nkro.touch[key];
+        if (!code) {
+            continue;
+        }
+        uint64_t bit = 1ULL << (code % 64);
+        hot->nkro_touch_all[code / 64] |= bit;
+        for (int value = 0; value < 16; value++) {
+            if (value & (1 << (key % 4))) {
+                hot->nkro_touch[key / 4][value][code / 64] |= bit;
+            }
+        }
+    }
+
+    for (int i = 0; i < 12; i++) {
+        uint8_t actuation = mai_cfg->analog.actuation[i];
+        hot->analog_actuation[i] = actuation ? actuation : ANALOG_ACTUATION_DEFAULT;
+    }
+    memcpy(hot->analog_press, mai_cfg->analog.press, sizeof(hot->analog_press));
+    memcpy(hot->analog_release, mai_cfg->analog.release, sizeof(hot->analog_release));
+
+    memcpy(hot->touch_map, mai_cfg->alt.touch, sizeof(hot->touch_map));
+
+    for (int i = 0; i < 256; i++) {
+        hot->level[i] = i * mai_cfg->color.level / 255;
+    }
+
+    uint32_t save = spin_lock_blocking(hot_lock);
+    mai_hot = scratch;
+    spin_unlock(hot_lock, save);
+}
+
+uint32_t mai_hot_lock()
+{
+    return spin_lock_blocking(hot_lock);
+}
+
+void mai_hot_unlock(uint32_t save)
+{
+    spin_unlock(hot_lock, save);
+}
+
 static void config_loaded()
 {
     if ((mai_cfg->sense.filter & 0x0f) > 3 ||
@@ -118,15 +220,69 @@ static void config_loaded()
         config_changed();
     }
 
+    if (mai_cfg->button.mode > 2) {
+        mai_cfg->button = default_cfg.button;
+        config_changed();
+    }
+
+    if ((mai_cfg->delay.button > 63) || (mai_cfg->delay.touch > 63) ||
+        (mai_cfg->delay.nkro > 63)) {
+        mai_cfg->delay = default_cfg.delay;
+        config_changed();
+    }
+
+    if (mai_cfg->expander.bits > 20) {
+        mai_cfg->expander = default_cfg.expander;
+        config_changed();
+    }
+
+    if (mai_cfg->usb.profile >= USB_PROFILE_NUM) {
+        mai_cfg->usb = default_cfg.usb;
+        config_changed();
+    }
+
+    if ((mai_cfg->report.touch > 1) || (mai_cfg->report.stamp > 1)) {
+        mai_cfg->report = default_cfg.report;
+        config_changed();
+    }
+
+    if ((mai_cfg->serial.latest > 1) || (mai_cfg->serial.on_change > 1) ||
+        (mai_cfg->serial.keepalive > SERIAL_KEEPALIVE_MAX) ||
+        (mai_cfg->serial.min_gap_us > SERIAL_MIN_GAP_MAX)) {
+        mai_cfg->serial = default_cfg.serial;
+        config_changed();
+    }
+
+    if (mai_cfg->sof.offset_us > SOF_OFFSET_MAX) {
+        mai_cfg->sof = default_cfg.sof;
+        config_changed();
+    }
+
+    for (int i = 0; i < 34; i++) {
+        if (mai_cfg->nkro.touch[i] >= NKRO_KEY_MAX) {
+            mai_cfg->nkro = default_cfg.nkro;
+            config_changed();
+            break;
+        }
+    }
+
+    if (!in_range(mai_cfg->latch.frames, 1, 16)) {
+        mai_cfg->latch = default_cfg.latch;
+        config_changed();
+    }
+
     if (!touch_map_valid()) {
         memcpy(mai_cfg->alt.touch, default_cfg.alt.touch,
                sizeof(mai_cfg->alt.touch));
         config_changed();
     }
+
+    hot_rebuild();
 }
 
 void config_changed()
 {
+    hot_rebuild();
 #ifdef AZAMAI_BUILD
     return;
 #endif
@@ -139,13 +295,16 @@ void config_factory_reset()
     return;
 #endif
     *mai_cfg = default_cfg;
+    hot_rebuild();
     save_request(true);
 }
 
 void config_init()
 {
+    hot_lock = spin_lock_init(spin_lock_claim_unused(true));
     mai_cfg = (mai_cfg_t *)save_alloc(sizeof(*mai_cfg), &default_cfg, config_loaded);
 #ifdef AZAMAI_BUILD
     *mai_cfg = default_cfg;
 #endif
+    hot_rebuild();
 }
@@ -46,6 +46,49 @@ typedef struct __attribute__((packed)) {
         uint8_t unused_bits : 6;
         uint8_t reserved[3];
     } tweak;
+    struct {
+        uint8_t mode; // 0: polling, 1: edge capture, 2: PIO sampler
+        uint8_t freeze[12]; // debounce freeze time in 100us, 0: default
+    } button;
+    struct {
+        uint16_t buttons; // bitmap of latched buttons
+        uint8_t frames; // reports a latched press stays visible
+    } latch;
+    struct {
+        uint8_t button; // in ms, 0: no delay
+        uint8_t touch;
+        uint8_t nkro;
+    } delay;
+    struct {
+        uint16_t buttons; // bitmap of analog buttons, GPIO 26..29 only
+        uint8_t actuation[12]; // travel 1..255, 0: default
+        uint8_t press[12]; // rapid trigger travel deltas, 0: off
+        uint8_t release[12];
+    } analog;
+    struct {
+        uint8_t bits; // 74HC165 chain inputs used, 0: off
+        uint8_t active_high;
+    } expander;
+    struct {
+        uint16_t offset_us; // sample this long before SOF, 0: free running
+    } sof;
+    struct {
+        uint8_t keepalive; // ms an unchanged report is held back, 0: send all
+        uint8_t touch; // touch map in the IO4 report padding
+        uint8_t stamp; // device time and sequence in reports and touch frames
+    } report;
+    struct {
+        uint8_t touch[34]; // key usage of each touch zone, 0: none
+    } nkro;
+    struct {
+        uint8_t profile; // enum usb_profile
+    } usb;
+    struct {
+        uint8_t latest; // serial touch: drop stale frames on a slow host
+        uint8_t on_change; // send a frame as soon as the touch changes
+        uint8_t keepalive; // ms between frames without changes, 0: 1ms
+        uint16_t min_gap_us; // between any two frames, with on_change
+    } serial;
     uint8_t reserved[8];
 } mai_cfg_t;
 
@@ -54,8 +97,47 @@ typedef struct {
     bool key_stuck;
 } mai_runtime_t;
 
+#define SERIAL_KEEPALIVE_MAX 100 // ms
+#define SERIAL_MIN_GAP_MAX 1000 // us
+
+#define NKRO_KEY_MAX 120 // keymap holds 15 bytes of usage bits
+
+/* Compiled from mai_cfg whenever it changes, hot paths only read this */
+typedef struct {
+    uint32_t latch_buttons;
+    uint8_t latch_frames;
+    uint8_t hid_joy;
+    uint8_t hid_nkro;
+    uint8_t hid_keepalive;
+    uint8_t hid_touch;
+    uint8_t stamp;
+    uint8_t serial_latest;
+    uint8_t serial_on_change;
+    uint16_t serial_min_gap;
+    uint32_t serial_keepalive; // us
+    uint8_t delay_button;
+    uint8_t delay_touch;
+    uint8_t delay_nkro;
+    uint16_t sof_offset;
+    uint8_t rgb_per[2]; // main, aux
+    uint8_t nkro_byte[32]; // keymap byte of each button, 0xff: no key
+    uint8_t nkro_bit[32]; // keymap bit mask of each button
+    uint64_t nkro_touch[9][16][2]; // keymap bits for each touch map nibble
+    uint64_t nkro_touch_all[2]; // every keymap bit touch zones own
+    uint8_t analog_actuation[12];
+    uint8_t analog_press[12];
+    uint8_t analog_release[12];
+    uint8_t touch_map[36];
+    uint8_t level[256]; // brightness scaled by color.level
+} mai_hot_t;
+
 extern mai_cfg_t *mai_cfg;
 extern mai_runtime_t mai_runtime;
+extern mai_hot_t mai_hot;
+
+/* Core1 reads of mai_hot go under this, it may be rebuilt meanwhile */
+uint32_t mai_hot_lock();
+void mai_hot_unlock(uint32_t save);
 
 void config_init();
 void config_changed(); // Notify the config has changed
@@ -0,0 +1,126 @@
+/*
+ * Input Event Bus
+ * WHowe <github.com/whowechina>
+ *
+ * Producers publish input changes into one ring, each consumer walks the
+ * ring with its own cursor, so every consumer sees every change once and
+ * in order. Publishing takes a hardware spin lock (producers live on both
+ * cores and in IRQs), reading takes no lock at all: an entry is checked
+ * again after being copied, in case a producer lapped the reader.
+ */
+
+#include "event.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+
+static struct {
+    event_t ring[EVENT_RING_LEN];
+    volatile uint32_t head;
+    spin_lock_t *lock;
+    uint32_t published[EVENT_SOURCE_NUM];
+    event_sub_t *subs[EVENT_MAX_SUBS];
+    int sub_num;
+} bus;
+
+void event_init()
+{
+    bus.lock = spin_lock_init(spin_lock_claim_unused(true));
+}
+
+void event_publish(uint8_t source, uint64_t state, uint64_t changed, uint32_t time)
+{
+    if (!bus.lock) {
+        return;
+    }
+
+    uint32_t save = spin_lock_blocking(bus.lock);
+    event_t *event = &bus.ring[bus.head % EVENT_RING_LEN];
+    event->state = state;
+    event->changed = changed;
+    event->time = time;
+    event->source = source;
+    __dmb();
+    bus.head++;
+    if (source < EVENT_SOURCE_NUM) {
+        bus.published[source]++;
+    }
+    spin_unlock(bus.lock, save);
+}
+
+void event_subscribe(event_sub_t *sub, const char *name)
+{
+    memset(sub, 0, sizeof(*sub));
+    sub->name = name;
+    sub->cursor = bus.head;
+    if (bus.sub_num < EVENT_MAX_SUBS) {
+        bus.subs[bus.sub_num++] = sub;
+    }
+}
+
+bool event_next(event_sub_t *sub, event_t *event)
+{
+    while (1) {
+        uint32_t head = bus.head;
+        __dmb();
+        if (sub->cursor == head) {
+            return false;
+        }
+        /* the oldest slot is the next one to be written */
+        if (head - sub->cursor >= EVENT_RING_LEN) {
+            sub->missed += head - sub->cursor - (EVENT_RING_LEN - 1);
+            sub->cursor = head - (EVENT_RING_LEN - 1);
+        }
+
+        *event = bus.ring[sub->cursor % EVENT_RING_LEN];
+        __dmb();
+        if (bus.head - sub->cursor >= EVENT_RING_LEN) {
+            continue; /* overwritten while copying */
+        }
+
+        sub->cursor++;
+        sub->count++;
+        uint32_t latency = time_us_32() - event->time;
+        sub->latency_sum += latency;
+        if (latency > sub->latency_max) {
+            sub->latency_max = latency;
+        }
+        return true;
+    }
+}
+
+uint32_t event_published(uint8_t source)
+{
+    if (source >= EVENT_SOURCE_NUM) {
+        return 0;
+    }
+    return bus.published[source];
+}
+
+int event_sub_num()
+{
+    return bus.sub_num;
+}
+
+const event_sub_t *event_sub(int index)
+{
+    if (index >= bus.sub_num) {
+        return NULL;
+    }
+    return bus.subs[index];
+}
+
+void event_reset_stat()
+{
+    memset(bus.published, 0, sizeof(bus.published));
+    for (int i = 0; i < bus.sub_num; i++) {
+        bus.subs[i]->count = 0;
+        bus.subs[i]->missed = 0;
+        bus.subs[i]->latency_max = 0;
+        bus.subs[i]->latency_sum = 0;
+    }
+}
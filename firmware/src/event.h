@@ -0,0 +1,50 @@
+/*
+ * Input Event Bus
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef EVENT_H
+#define EVENT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define EVENT_RING_LEN 128 // must be a power of 2
+#define EVENT_MAX_SUBS 8
+
+enum event_source {
+    EVENT_BUTTON = 0,
+    EVENT_TOUCH,
+    EVENT_UART_TOUCH,
+    EVENT_SOURCE_NUM,
+};
+
+typedef struct {
+    uint64_t state; // whole state after the change
+    uint64_t changed;
+    uint32_t time; // time_us_32() when it changed
+    uint8_t source;
+} event_t;
+
+typedef struct {
+    const char *name;
+    uint32_t cursor;
+    uint32_t count;
+    uint32_t missed; // overwritten before being read
+    uint32_t latency_max;
+    uint64_t latency_sum;
+} event_sub_t;
+
+void event_init();
+void event_publish(uint8_t source, uint64_t state, uint64_t changed, uint32_t time);
+
+/* Each subscriber is read by one consumer only, it sees new events only */
+void event_subscribe(event_sub_t *sub, const char *name);
+bool event_next(event_sub_t *sub, event_t *event);
+
+uint32_t event_published(uint8_t source);
+int event_sub_num();
+const event_sub_t *event_sub(int index);
+void event_reset_stat();
+
+#endif
@@ -1,22 +1,37 @@
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
 
 #include "board_defs.h"
 
 #include "tusb.h"
 #include "usb_descriptors.h"
+#include "analog.h"
 #include "button.h"
 #include "config.h"
+#include "event.h"
 #include "hid.h"
+#include "stamp.h"
+#include "usbstat.h"
 
-struct __attribute__((packed)) {
+#ifndef AZAMAI_BUILD
+#include "touch.h"
+#endif
+
+#include "hardware/timer.h"
+
+struct __attribute__((packed)) joy_report {
     uint16_t adcs[8];
     uint16_t spinners[4];
     uint16_t chutes[2];
     uint16_t buttons[2];
     uint8_t system_status;
     uint8_t usb_status;
-    uint8_t padding[29];
+    uint8_t touch[5]; // 34 touch bits, only with report.touch on
+    uint8_t touch_seq; // counts touch changes
+    stamp_t stamp; // only with report.stamp on, filled when staged
+    uint8_t padding[15];
 } hid_joy;
 
 struct __attribute__((packed)) {
@@ -24,7 +39,7 @@ struct __attribute__((packed)) {
     uint8_t keymap[15];
 } hid_nkro;
 
-static uint16_t native_to_io4(uint16_t button)
+static uint16_t native_to_io4(uint32_t button)
 {
     static const int target_pos[] = { 2, 3, 0, 15, 14, 13, 12, 11, 1, 9, 6 };
     uint16_t io4btn = 0;
@@ -39,54 +54,338 @@ static uint16_t native_to_io4(uint16_t button)
     return io4btn;
 }
 
+/*
+ * A latched press is ORed into every report until it has actually gone out
+ * in latch.frames reports, so taps shorter than a report are never lost,
+ * even when a busy endpoint makes us skip a few. Each staged report keeps
+ * the pending bits it was built with, only those retire once it's out.
+ */
+typedef struct {
+    uint32_t pending; // not reported yet
+    uint32_t held;
+    uint8_t remain[BUTTON_MAX];
+} latch_t;
+
+static latch_t latch[2]; // joy, nkro
+
+static void latch_feed(uint32_t presses)
+{
+    latch[0].pending |= presses;
+    latch[1].pending |= presses;
+}
+
+static inline uint32_t latch_apply(latch_t *ctx, uint32_t buttons)
+{
+    return buttons | ctx->pending | ctx->held;
+}
+
+static void latch_sent(latch_t *ctx, uint32_t carried)
+{
+    carried &= ctx->pending;
+    uint32_t visible = carried | ctx->held;
+    for (int i = 0; visible; i++, visible >>= 1) {
+        if (!(visible & 1)) {
+            continue;
+        }
+        if (carried & (1u << i)) {
+            ctx->remain[i] = mai_hot.latch_frames;
+        }
+        ctx->remain[i]--;
+        if (ctx->remain[i] > 0) {
+            ctx->held |= 1u << i;
+        } else {
+            ctx->held &= ~(1u << i);
+        }
+    }
+    ctx->pending &= ~carried;
+}
+
+/*
+ * Each report is built in place, then copied into the back half of a
+ * double buffer and flipped to the front. Whoever finds the endpoint free
+ * first sends the front: hid_update() right away, or the completion
+ * callback of the previous report, so a change never waits for a tick.
+ * A report the host already has is held back until the keepalive is due.
+ * Stamps are left out of that comparison, they are written when staged,
+ * so a gap in the host's sequence is a report replaced before it went out.
+ */
+typedef struct {
+    uint8_t buf[2][64];
+    uint32_t carried[2]; // latch pending bits built into each buffer
+    uint32_t sent_carried; // and into the latest one that went out
+    uint8_t last[64]; // last one handed to the stack
+    uint32_t last_time;
+    volatile uint8_t front;
+    volatile bool dirty;
+    volatile bool force; // host asked for an answer
+    volatile uint32_t put_seq; // reports staged
+    volatile uint32_t sent_seq; // latest staged report that went out
+    uint32_t seen_seq;
+    uint8_t itf;
+    uint8_t report_id;
+    uint16_t len;
+    uint16_t stamp_at; // 0: no room for a stamp
+    uint32_t stamp_seq;
+    hid_stat_t stat;
+} stage_t;
+
+static stage_t stage[2] = {
+    { .itf = 0, .report_id = REPORT_ID_JOYSTICK, .len = sizeof(hid_joy),
+      .stamp_at = offsetof(struct joy_report, stamp) },
+    { .itf = 1, .report_id = 0, .len = sizeof(hid_nkro) },
+};
+
+static void stage_send(stage_t *ctx)
+{
+    if (!ctx->dirty) {
+        return;
+    }
+    if (!tud_hid_n_ready(ctx->itf)) {
+        usbstat_hid_busy(ctx->itf);
+        return;
+    }
+    uint32_t seq = ctx->put_seq;
+    uint8_t front = ctx->front;
+    ctx->dirty = false;
+    const uint8_t *report = ctx->buf[front];
+    if (tud_hid_n_report(ctx->itf, ctx->report_id, report, ctx->len)) {
+        memcpy(ctx->last, report, ctx->len);
+        ctx->last_time = time_us_32();
+        ctx->sent_carried = ctx->carried[front];
+        ctx->sent_seq = seq;
+        ctx->stat.sent++;
+        usbstat_hid_sent(ctx->itf);
+    } else {
+        ctx->dirty = true;
+        usbstat_hid_failed(ctx->itf);
+    }
+}
+
+/* what the IO4 host asked for, 0 if it never did */
+static struct {
+    uint16_t timeout; // ms
+    uint16_t sampling;
+} io4_req;
+
+/* the host wants to hear from us well within its timeout, so the joy
+   report keepalive is capped at half of it */
+static uint32_t stage_keepalive(stage_t *ctx)
+{
+    uint32_t keepalive = mai_hot.hid_keepalive * 1000;
+    if ((ctx == &stage[0]) && io4_req.timeout) {
+        uint32_t limit = io4_req.timeout * 1000 / 2;
+        if (!keepalive || (limit < keepalive)) {
+            keepalive = limit;
+        }
+    }
+    return keepalive;
+}
+
+static void stage_put(stage_t *ctx, const void *report, uint32_t carried)
+{
+    uint32_t keepalive = stage_keepalive(ctx);
+    bool stamped = ctx->stamp_at && mai_hot.stamp;
+    uint16_t cmp_len = stamped ? ctx->stamp_at : ctx->len;
+    if (keepalive && !ctx->dirty && !ctx->force &&
+        (time_us_32() - ctx->last_time < keepalive) &&
+        (memcmp(report, ctx->last, cmp_len) == 0)) {
+        /* the host sees exactly this, so latches count it as delivered */
+        ctx->put_seq++;
+        ctx->sent_carried = carried;
+        ctx->sent_seq = ctx->put_seq;
+        ctx->stat.suppressed++;
+        return;
+    }
+
+    if (ctx->dirty) {
+        ctx->stat.replaced++;
+    }
+    ctx->force = false;
+    uint8_t back = !ctx->front;
+    memcpy(ctx->buf[back], report, ctx->len);
+    ctx->carried[back] = carried;
+    if (stamped) {
+        stamp_t stamp = { time_us_32(), ++ctx->stamp_seq };
+        memcpy(ctx->buf[back] + ctx->stamp_at, &stamp, sizeof(stamp));
+    }
+    ctx->front = back;
+    ctx->put_seq++;
+    ctx->dirty = true;
+    stage_send(ctx);
+}
+
+/* true once for each staged report that went out */
+static bool stage_delivered(stage_t *ctx, uint32_t *carried)
+{
+    uint32_t seq = ctx->sent_seq;
+    if (seq == ctx->seen_seq) {
+        return false;
+    }
+    ctx->seen_seq = seq;
+    *carried = ctx->sent_carried;
+    return true;
+}
+
+static void (*complete_cb)();
+
+void hid_on_complete(void (*callback)())
+{
+    complete_cb = callback;
+}
+
+void hid_flush()
+{
+    for (int i = 0; i < 2; i++) {
+        stage_send(&stage[i]);
+    }
+}
+
+/* With tud_task() in a task of its own, stage_send() must not run here
+   and in hid_update() at the same time, so the owner gets told instead. */
+void tud_hid_report_complete_cb(uint8_t instance, uint8_t const *report, uint16_t len)
+{
+    if (complete_cb) {
+        complete_cb();
+        return;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (stage[i].itf == instance) {
+            stage_send(&stage[i]);
+        }
+    }
+}
+
+static uint64_t uart_touch; // latest from the touch board, Azamai only
+
+/* The touch board keeps no history, so on Azamai delay.nkro only holds
+   back the buttons */
+static uint64_t touch_map(uint8_t ticks)
+{
+#ifdef AZAMAI_BUILD
+    return uart_touch;
+#else
+    return ticks ? touch_touchmap_delayed(ticks) : touch_touchmap();
+#endif
+}
+
+static void touch_fill()
+{
+    uint64_t map = touch_map(0);
+    static uint64_t last;
+    if (map != last) {
+        hid_joy.touch_seq++;
+        last = map;
+    }
+    for (int i = 0; i < 5; i++) {
+        hid_joy.touch[i] = map >> (i * 8);
+    }
+}
+
+/* before new presses come in, they can't be in what went out */
+static void latch_retire()
+{
+    for (int i = 0; i < 2; i++) {
+        uint32_t carried;
+        if (stage_delivered(&stage[i], &carried)) {
+            latch_sent(&latch[i], carried);
+        }
+    }
+}
+
 static void report_usb_hid()
 {
-    if (tud_hid_ready()) {
-        if (mai_cfg->hid.joy || mai_runtime.key_stuck) {
-            static uint16_t last_buttons = 0;
-            uint16_t buttons = button_read();
-            hid_joy.buttons[0] = native_to_io4(buttons);
-            hid_joy.buttons[1] = native_to_io4(0);
-            if ((last_buttons ^ buttons) & (1 << 11)) {
-                if (buttons & (1 << 11)) {
-                   // just pressed coin button
-                   hid_joy.chutes[0] += 0x100;
-                }
+    if (mai_hot.hid_joy || mai_runtime.key_stuck) {
+        uint32_t buttons = latch_apply(&latch[0], button_read());
+        hid_joy.buttons[0] = native_to_io4(buttons);
+        /* expander buttons are player 2 in the same order */
+        hid_joy.buttons[1] = native_to_io4(buttons >> button_num());
+        for (int i = 0; i < button_num(); i++) {
+            const analog_info_t *info = analog_info(i);
+            if (info) {
+                uint8_t ch = button_real_gpio(i) - ANALOG_GPIO_BASE;
+                hid_joy.adcs[ch] = info->travel << 8;
             }
-            tud_hid_n_report(0, REPORT_ID_JOYSTICK, &hid_joy, sizeof(hid_joy));
-            last_buttons = buttons;
         }
-        if (mai_cfg->hid.nkro && !mai_runtime.key_stuck) {
-            tud_hid_n_report(1, 0, &hid_nkro, sizeof(hid_nkro));
+        if (mai_hot.hid_touch) {
+            touch_fill();
+        } else {
+            memset(hid_joy.touch, 0, sizeof(hid_joy.touch));
         }
+        stage_put(&stage[0], &hid_joy, latch[0].pending);
+    }
+    if (mai_hot.hid_nkro && !mai_runtime.key_stuck && usb_has_nkro()) {
+        stage_put(&stage[1], &hid_nkro, latch[1].pending);
     }
 }
 
-const char keymap_p1[] = BUTTON_NKRO_MAP_P1;
-const char keymap_p2[] = BUTTON_NKRO_MAP_P2;
+static void nkro_touch()
+{
+    uint64_t map = touch_map(mai_hot.delay_nkro);
+    uint64_t keys[2] = { 0 };
+    for (int i = 0; i < 9; i++) {
+        const uint64_t *bits = mai_hot.nkro_touch[i][(map >> (i * 4)) & 0x0f];
+        keys[0] |= bits[0];
+        keys[1] |= bits[1];
+    }
+
+    uint64_t keymap[2] = { 0 };
+    memcpy(keymap, hid_nkro.keymap, sizeof(hid_nkro.keymap));
+    keymap[0] = (keymap[0] & ~mai_hot.nkro_touch_all[0]) | keys[0];
+    keymap[1] = (keymap[1] & ~mai_hot.nkro_touch_all[1]) | keys[1];
+    memcpy(hid_nkro.keymap, keymap, sizeof(hid_nkro.keymap));
+}
 
 static void gen_nkro_report()
 {
-    if (!mai_cfg->hid.nkro) {
+    if (!mai_hot.hid_nkro || !usb_has_nkro()) {
         return;
     }
 
-    uint16_t buttons = button_read();
-    const char *keymap = (mai_cfg->hid.nkro == 2) ? keymap_p2 : keymap_p1;
-    for (int i = 0; i < button_num(); i++) {
-        uint8_t code = keymap[i];
-        uint8_t byte = code / 8;
-        uint8_t bit = code % 8;
-        if (buttons & (1 << i)) {
-            hid_nkro.keymap[byte] |= (1 << bit);
+    if (mai_hot.nkro_touch_all[0] | mai_hot.nkro_touch_all[1]) {
+        nkro_touch();
+    }
+
+    uint32_t buttons = latch_apply(&latch[1], button_read_delayed(mai_hot.delay_nkro));
+    int num = button_num() + button_expander_num();
+    for (int i = 0; i < num; i++) {
+        uint8_t byte = mai_hot.nkro_byte[i];
+        if (byte == 0xff) {
+            continue;
+        }
+        if (buttons & (1u << i)) {
+            hid_nkro.keymap[byte] |= mai_hot.nkro_bit[i];
         } else {
-            hid_nkro.keymap[byte] &= ~(1 << bit);
+            hid_nkro.keymap[byte] &= ~mai_hot.nkro_bit[i];
         }
     }
 }
 
+static event_sub_t hid_sub;
+
+/* every coin press counts, even if it never made it into a report */
+static void hid_events()
+{
+    event_t event;
+    while (event_next(&hid_sub, &event)) {
+        if ((event.source == EVENT_BUTTON) &&
+            (event.state & event.changed & (1 << 11))) {
+            hid_joy.chutes[0] += 0x100;
+        } else if (event.source == EVENT_UART_TOUCH) {
+            uart_touch = event.state;
+        }
+    }
+}
+
+void hid_init()
+{
+    event_subscribe(&hid_sub, "hid");
+}
+
 void hid_update()
 {
+    hid_events();
+    latch_retire();
+    latch_feed(button_take_presses() & mai_hot.latch_buttons);
     gen_nkro_report();
     report_usb_hid();
 }
@@ -102,14 +401,27 @@ void hid_proc(const uint8_t *data, uint8_t len)
     hid_output_t *output = (hid_output_t *)data;
     if (output->report_id == REPORT_ID_OUTPUT) {
         switch (output->cmd) {
-            case 0x01: // Set Timeout
-            case 0x02: // Set Sampling Count
+            case 0x01: // Set Timeout, big-endian, taken as ms
+                io4_req.timeout = (output->payload[0] << 8) | output->payload[1];
                 hid_joy.system_status = 0x30;
+                stage[0].force = true;
                 break;
+            case 0x02: { // Set Sampling Count, big-endian
+                uint16_t count = (output->payload[0] << 8) | output->payload[1];
+                if (count > BUTTON_SAMPLING_MAX) {
+                    count = BUTTON_SAMPLING_MAX;
+                }
+                io4_req.sampling = count;
+                button_set_sampling(count);
+                hid_joy.system_status = 0x30;
+                stage[0].force = true;
+                break;
+            }
             case 0x03: // Clear Board Status
                 hid_joy.chutes[0] = 0;
                 hid_joy.chutes[1] = 0;
                 hid_joy.system_status = 0x00;
+                stage[0].force = true;
                 break;
             case 0x04: // Set General Output
             case 0x41: // I don't know what this is
@@ -120,3 +432,42 @@ void hid_proc(const uint8_t *data, uint8_t len)
         }
     }
 }
+
+/* the latest staged report, never waits for anything */
+uint16_t hid_get_report(uint8_t itf, uint8_t report_id, uint8_t *buffer, uint16_t reqlen)
+{
+    for (int i = 0; i < 2; i++) {
+        stage_t *ctx = &stage[i];
+        if ((ctx->itf != itf) || (ctx->report_id != report_id)) {
+            continue;
+        }
+        uint16_t len = (reqlen < ctx->len) ? reqlen : ctx->len;
+        memcpy(buffer, ctx->buf[ctx->front], len);
+        return len;
+    }
+    return 0;
+}
+
+uint16_t hid_io4_timeout()
+{
+    return io4_req.timeout;
+}
+
+uint16_t hid_io4_sampling()
+{
+    return io4_req.sampling;
+}
+
+const hid_stat_t *hid_stat(int itf)
+{
+    if ((itf < 0) || (itf > 1)) {
+        return NULL;
+    }
+    return &stage[itf].stat;
+}
+
+void hid_reset_stat()
+{
+    memset(&stage[0].stat, 0, sizeof(stage[0].stat));
+    memset(&stage[1].stat, 0, sizeof(stage[1].stat));
+}
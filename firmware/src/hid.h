@@ -6,7 +6,31 @@
 #ifndef HID_H_
 #define HID_H_
 
+#include <stdint.h>
+
+typedef struct {
+    uint32_t sent;
+    uint32_t suppressed; // unchanged, held back
+    uint32_t replaced; // staged but never sent, a newer one took its place
+} hid_stat_t;
+
+void hid_init();
 void hid_update();
 void hid_proc(const uint8_t *data, uint8_t len);
 
+/* Called from the stack when a report went out. If set, whoever runs
+   hid_update() is expected to call hid_flush() soon after. */
+void hid_on_complete(void (*callback)());
+void hid_flush(); // send staged reports if the endpoints are free
+
+/* Input report for GET_REPORT, the report ID is not included */
+uint16_t hid_get_report(uint8_t itf, uint8_t report_id, uint8_t *buffer, uint16_t reqlen);
+
+/* Latest Set Timeout and Set Sampling Count from the IO4 host, 0 if none */
+uint16_t hid_io4_timeout();
+uint16_t hid_io4_sampling();
+
+const hid_stat_t *hid_stat(int itf); // 0: joy, 1: nkro
+void hid_reset_stat();
+
 #endif
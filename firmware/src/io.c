@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "io.h"
 #include "tusb.h"
@@ -12,6 +13,10 @@
 
 #include "touch.h"
 #include "rgb.h"
+#include "stamp.h"
+#include "cdc_tx.h"
+#include "usbstat.h"
+#include "config.h"
 
 #define IO_TIMEOUT_SEC 60
 
@@ -19,7 +24,7 @@ static struct {
     bool stat;
     uint64_t last_io_time;
     int touch_interface;
-} ctx = { false, 0, 0 };
+} ctx = { false, 0, -1 };
 
 typedef union {
     uint8_t raw[28];
@@ -68,45 +73,50 @@ typedef union {
 #define SYNC 0xE0
 #define ESCAPE 0xD0
 
+typedef union {
+    uint8_t raw[32];
+    struct {
+        struct {
+            uint8_t dst;
+            uint8_t src;
+            uint8_t len;
+            uint8_t cmd;
+        } hdr;
+        led_data_t led;
+    };
+} led_frame_t;
+
+#define RX_LEN 128
+#define LED_FRAME_MAX 48 // header and payload, longer frames are dropped
+#define TOUCH_CMD_LEN 4
+
 typedef struct {
-    int interface;
+    uint8_t port;
+    int interface; // CDC instance in the running USB profile, -1: not there
     bool connected;
-    bool in_cmd;
-    bool is_touch;
+    const led_frame_t *frame; // LED command being handled, a view into rx
+    /* an LED frame cut short by the end of data waits at rx[0] */
+    bool resume;
     bool escape;
-    union {
-        uint8_t buf[48];
-        struct {
-            struct {
-                uint8_t dst;
-                uint8_t src;
-                uint8_t len;
-                uint8_t cmd;
-            } hdr;
-            led_data_t led;
-        };
-    };
-    uint8_t len;
+    uint8_t have; // unescaped bytes of it
     uint8_t checksum;
+    uint16_t rx_len;
+    /* room for a frame view at the very end to read a whole led_frame_t */
+    uint8_t rx[RX_LEN + sizeof(led_frame_t)] __attribute__((aligned(4)));
 } cdc_t;
 
 static cdc_t cdc[2] = {
-    { .interface = 1 },
-    { .interface = 2 },
+    { .port = USB_PORT_TOUCH },
+    { .port = USB_PORT_LED },
 };
 
-static void touch_cmd(cdc_t *cdc)
+static void touch_cmd(cdc_t *cdc, const uint8_t *cmd)
 {
-    cdc->in_cmd = false;
-    if (cdc->len != 4) {
-        return;
-    }
-    cdc->len = 0;
     ctx.last_io_time = time_us_64();
 
     ctx.touch_interface = cdc->interface;
 
-    switch (cdc->buf[2]) {
+    switch (cmd[2]) {
         case 'E':
             printf("Touch RSET\n");
             break;
@@ -119,58 +129,50 @@ static void touch_cmd(cdc_t *cdc)
             ctx.stat = true;
             break;
         case 'r':
-            //printf("Touch Ratio\n");
-            tud_cdc_n_write_char(cdc->interface, '(');
-            tud_cdc_n_write_char(cdc->interface, cdc->buf[0]); //L,R
-            tud_cdc_n_write_char(cdc->interface, cdc->buf[1]); //sensor
-            tud_cdc_n_write_char(cdc->interface, 'r');
-            tud_cdc_n_write_char(cdc->interface, cdc->buf[3]); // Ratio
-            tud_cdc_n_write_char(cdc->interface, ')');
-            tud_cdc_n_write_flush(cdc->interface);
-            break;
         case 'k':
-            // printf("Touch Sense\n");
-            tud_cdc_n_write_char(cdc->interface, '(');
-            tud_cdc_n_write_char(cdc->interface, cdc->buf[0]); //L,R
-            tud_cdc_n_write_char(cdc->interface, cdc->buf[1]); //sensor
-            tud_cdc_n_write_char(cdc->interface, 'k');
-            tud_cdc_n_write_char(cdc->interface, cdc->buf[3]); // Ratio
-            tud_cdc_n_write_char(cdc->interface, ')');
-            tud_cdc_n_write_flush(cdc->interface);
+            // Ratio or Sense, echoed back
+            {
+                const uint8_t resp[6] = {
+                    '(', cmd[0], cmd[1], // L/R, sensor
+                    cmd[2], cmd[3], ')' // r/k, ratio
+                };
+                cdc_tx_write(cdc->port, resp, sizeof(resp));
+                cdc_tx_end(cdc->port);
+            }
             break;
         default:
-            printf("Touch CMD Unknown: %*s -> ", 4, cdc->buf);
+            printf("Touch CMD Unknown: %.*s -> ", TOUCH_CMD_LEN, cmd);
             return;
     }
 }
 
 static void led_write(cdc_t *cdc, led_resp_t *resp)
 {
-    tud_cdc_n_write_char(cdc->interface, SYNC); // SYNC
+    cdc_tx_put(cdc->port, SYNC); // SYNC
 
     uint8_t checksum = 0;
     for (int i = 0; i < resp->hdr.len + 3; i++) {
         uint8_t c = resp->raw[i];
         checksum += c;
         if (c == SYNC || c == ESCAPE) {
-            tud_cdc_n_write_char(cdc->interface, ESCAPE);
-            tud_cdc_n_write_char(cdc->interface, c - 1);
+            cdc_tx_put(cdc->port, ESCAPE);
+            cdc_tx_put(cdc->port, c - 1);
         } else {
-            tud_cdc_n_write_char(cdc->interface, c);
+            cdc_tx_put(cdc->port, c);
         }
     }
-    tud_cdc_n_write_char(cdc->interface, checksum);
-    tud_cdc_n_write_flush(cdc->interface);
+    cdc_tx_put(cdc->port, checksum);
+    cdc_tx_end(cdc->port);
 }
 
 static led_resp_t *led_init_resp(cdc_t *cdc, uint8_t payload_len)
 {
     static led_resp_t resp;
-    resp.hdr.dst = cdc->hdr.src;
-    resp.hdr.src = cdc->hdr.dst;
+    resp.hdr.dst = cdc->frame->hdr.src;
+    resp.hdr.src = cdc->frame->hdr.dst;
     resp.hdr.len = payload_len + 3;
     resp.hdr.status = 1;
-    resp.hdr.cmd = cdc->hdr.cmd;
+    resp.hdr.cmd = cdc->frame->hdr.cmd;
     resp.hdr.report = 1;
     return &resp;
 }
@@ -185,14 +187,14 @@ static uint8_t led_ram[256];
 
 static void led_set_eeprom(cdc_t *cdc)
 {
-    led_ram[cdc->led.eeprom.addr] = cdc->led.eeprom.data;
+    led_ram[cdc->frame->led.eeprom.addr] = cdc->frame->led.eeprom.data;
     led_ack_ok(cdc);
 }
 
 static void led_get_eeprom(cdc_t *cdc)
 {
     led_resp_t *resp = led_init_resp(cdc, 1);
-    resp->payload[0] = led_ram[cdc->led.eeprom.addr];
+    resp->payload[0] = led_ram[cdc->frame->led.eeprom.addr];
     led_write(cdc, resp);
 }
 
@@ -219,12 +221,10 @@ static void led_proto_ver(cdc_t *cdc)
 
 static void led_cmd(cdc_t *cdc)
 {
-    cdc->in_cmd = false;
-    cdc->len = 0;
     ctx.last_io_time = time_us_64();
 
     uint32_t color;
-    switch (cdc->hdr.cmd) {
+    switch (cdc->frame->hdr.cmd) {
         case 0x10:
             printf("LED RSET\n");
             for (int i = 0; i < 8; i++) {
@@ -235,29 +235,29 @@ static void led_cmd(cdc_t *cdc)
             }
             break;
         case 0x31:
-            color = rgb32(cdc->led.r, cdc->led.g, cdc->led.b, false);
-            //printf("LED %d:1 %06x\n", cdc->led.index, color);
-            rgb_set_button(cdc->led.index, color, 0);          
+            color = rgb32(cdc->frame->led.r, cdc->frame->led.g, cdc->frame->led.b, false);
+            //printf("LED %d:1 %06x\n", cdc->frame->led.index, color);
+            rgb_set_button(cdc->frame->led.index, color, 0);          
             break;
         case 0x32:
-            color = rgb32(cdc->led.mr, cdc->led.mg, cdc->led.mb, false);
-            //printf("LED %d:%d %06x\n", cdc->led.start, cdc->led.len, color, cdc->led.mb);
-            for (int i = 0; i < cdc->led.len; i++) {
-                rgb_set_button(i + cdc->led.start, color, 0);
+            color = rgb32(cdc->frame->led.mr, cdc->frame->led.mg, cdc->frame->led.mb, false);
+            //printf("LED %d:%d %06x\n", cdc->frame->led.start, cdc->frame->led.len, color, cdc->frame->led.mb);
+            for (int i = 0; i < cdc->frame->led.len; i++) {
+                rgb_set_button(i + cdc->frame->led.start, color, 0);
             }
             break;
         case 0x33:
-            color = rgb32(cdc->led.mr, cdc->led.mg, cdc->led.mb, false);
-            //printf("LED %d:%d %06x %d\n", cdc->led.start, cdc->led.len, color, cdc->led.speed);
-            for (int i = 0; i < cdc->led.len; i++) {
-                rgb_set_button(i + cdc->led.start, color, cdc->led.speed);
+            color = rgb32(cdc->frame->led.mr, cdc->frame->led.mg, cdc->frame->led.mb, false);
+            //printf("LED %d:%d %06x %d\n", cdc->frame->led.start, cdc->frame->led.len, color, cdc->frame->led.speed);
+            for (int i = 0; i < cdc->frame->led.len; i++) {
+                rgb_set_button(i + cdc->frame->led.start, color, cdc->frame->led.speed);
             }
             break;
         case 0x39:
             //printf("LED Fet\n");
-            rgb_set_cab(0, gray32(cdc->led.body, false));
-            rgb_set_cab(1, gray32(cdc->led.ext, false));
-            rgb_set_cab(2, gray32(cdc->led.side, false));
+            rgb_set_cab(0, gray32(cdc->frame->led.body, false));
+            rgb_set_cab(1, gray32(cdc->frame->led.ext, false));
+            rgb_set_cab(2, gray32(cdc->frame->led.side, false));
             break;
 
         case 0x7b:
@@ -277,101 +277,269 @@ static void led_cmd(cdc_t *cdc)
             return;
 
         default:
-            printf("Ignoring LED Cmd %02x\n", cdc->hdr.cmd);
+            printf("Ignoring LED Cmd %02x\n", cdc->frame->hdr.cmd);
             break;
     }
 
     led_ack_ok(cdc);
 }
 
-static inline void assemble_cmd(cdc_t *cdc, uint8_t c)
+/*
+ * Frames are parsed right where they were read to. A byte class table
+ * marks SYNC, ESCAPE and the touch brackets, and plain bytes are skipped
+ * a word at a time. An LED frame is unescaped in place (it only gets
+ * shorter), moving and summing whole spans between ESCAPEs, then the
+ * command gets a view of it. A frame cut short by the end of data moves
+ * to the front of rx and is picked up there after the next read.
+ */
+enum {
+    CLASS_SYNC = 1,
+    CLASS_ESCAPE = 2,
+    CLASS_OPEN = 4,
+    CLASS_CLOSE = 8,
+};
+
+static const uint8_t byte_class[256] = {
+    [SYNC] = CLASS_SYNC,
+    [ESCAPE] = CLASS_ESCAPE,
+    ['{'] = CLASS_OPEN,
+    ['}'] = CLASS_CLOSE,
+};
+
+/* high bit set in each byte of word equal to byte, may flag a few more */
+static inline uint32_t word_has(uint32_t word, uint8_t byte)
 {
-    if (c == SYNC) {
-        cdc->len = 0;
-        cdc->in_cmd = true;
-        cdc->is_touch = false;
-        cdc->escape = false;
-        cdc->checksum = 0;
-        return;
-    }
+    uint32_t x = word ^ (0x01010101u * byte);
+    return (x - 0x01010101u) & ~x & 0x80808080u;
+}
 
-    if ((!cdc->in_cmd || cdc->is_touch) && (c == '{')) {
-        cdc->len = 0;
-        cdc->in_cmd = true;
-        cdc->is_touch = true;
-        return;
+typedef uint32_t __attribute__((may_alias)) rx_word_t;
+
+/* first byte in [pos, end) of a class in mask, end if none */
+static inline int scan(const uint8_t *buf, int pos, int end, uint8_t mask)
+{
+    while (pos < end) {
+        if (((pos & 3) == 0) && (pos + 4 <= end)) {
+            uint32_t word = *(const rx_word_t *)(buf + pos);
+            uint32_t hit = 0;
+            hit |= (mask & CLASS_SYNC) ? word_has(word, SYNC) : 0;
+            hit |= (mask & CLASS_ESCAPE) ? word_has(word, ESCAPE) : 0;
+            hit |= (mask & CLASS_OPEN) ? word_has(word, '{') : 0;
+            hit |= (mask & CLASS_CLOSE) ? word_has(word, '}') : 0;
+            if (!hit) {
+                pos += 4;
+                continue;
+            }
+        }
+        if (byte_class[buf[pos]] & mask) {
+            return pos;
+        }
+        pos++;
     }
+    return end;
+}
 
-    if (cdc->is_touch) {
-        // Touch cmd
-        if (c == '}') {
-            touch_cmd(cdc);
-        } else if (cdc->len < sizeof(cdc->buf)) {
-            cdc->buf[cdc->len] = c;
-            cdc->len++;
+/* returns where to go on, -1 if the frame is incomplete and kept */
+static int led_parse(cdc_t *cdc, int start, int end)
+{
+    uint8_t *rx = cdc->rx;
+    int frame = start + 1;
+    int w = frame + (cdc->resume ? cdc->have : 0);
+    int r = w;
+    bool escape = cdc->resume && cdc->escape;
+    uint8_t sum = cdc->resume ? cdc->checksum : 0;
+    cdc->resume = false;
+
+    while (1) {
+        int have = w - frame;
+        /* header and payload, then the checksum */
+        int need = (have >= 3) ? rx[frame + 2] + 4 : 4;
+        if (need > LED_FRAME_MAX + 1) {
+            return r;
         }
-        return;
+        if (have == need) {
+            uint8_t checksum = rx[w - 1];
+            if ((uint8_t)(sum - checksum) == checksum) {
+                cdc->frame = (const led_frame_t *)(rx + frame);
+                led_cmd(cdc);
+            }
+            return r;
+        }
+        if (r == end) {
+            memmove(rx, rx + start, w - start);
+            cdc->rx_len = w - start;
+            cdc->have = have;
+            cdc->escape = escape;
+            cdc->checksum = sum;
+            cdc->resume = true;
+            return -1;
+        }
+
+        uint8_t c = rx[r];
+        if (c == SYNC) {
+            return r; // starts over
+        }
+        if (escape) {
+            escape = false;
+            rx[w++] = c + 1;
+            sum += c + 1;
+            r++;
+            continue;
+        }
+        if (c == ESCAPE) {
+            escape = true;
+            r++;
+            continue;
+        }
+
+        int stop = scan(rx, r, end, CLASS_SYNC | CLASS_ESCAPE);
+        if (stop - r > need - have) {
+            stop = r + need - have;
+        }
+        if (w != r) {
+            memmove(rx + w, rx + r, stop - r);
+        }
+        for (int i = w + stop - r; w < i; w++) {
+            sum += rx[w];
+        }
+        r = stop;
     }
+}
 
-    // LED cmd
-    if (c == ESCAPE) {
-        cdc->escape = true;
-        return;
+/* "{" + 4 bytes + "}", SYNC or another "{" starts over */
+static int touch_parse(cdc_t *cdc, int start, int end)
+{
+    uint8_t *rx = cdc->rx;
+    int limit = start + TOUCH_CMD_LEN + 2;
+    int stop = scan(rx, start + 1, (end < limit) ? end : limit,
+                    CLASS_SYNC | CLASS_OPEN | CLASS_CLOSE);
+    if (stop == end) {
+        if (end < limit) {
+            memmove(rx, rx + start, end - start);
+            cdc->rx_len = end - start;
+            return -1;
+        }
+        return end;
     }
-    
-    if (cdc->escape) {
-        cdc->escape = false;
-        c++;
+    if (stop == limit) {
+        return limit; // too long, not a command
     }
-
-    if ((cdc->len == cdc->hdr.len + 3) && (cdc->checksum == c)) {
-        led_cmd(cdc);
-        return;
+    if (rx[stop] != '}') {
+        return stop;
     }
-    
-    if (cdc->len < sizeof(cdc->buf)) {
-        cdc->buf[cdc->len] = c;
-        cdc->len++;
-        cdc->checksum += c;
+    if (stop == start + TOUCH_CMD_LEN + 1) {
+        touch_cmd(cdc, rx + start + 1);
+    }
+    return stop + 1;
+}
+
+static void io_parse(cdc_t *cdc)
+{
+    int end = cdc->rx_len;
+    int pos = 0;
+    while (1) {
+        int start = scan(cdc->rx, pos, end, CLASS_SYNC | CLASS_OPEN);
+        if (start == end) {
+            cdc->rx_len = 0;
+            cdc->resume = false;
+            return;
+        }
+        if (cdc->rx[start] == SYNC) {
+            pos = led_parse(cdc, start, end);
+        } else {
+            cdc->resume = false;
+            pos = touch_parse(cdc, start, end);
+        }
+        if (pos < 0) {
+            return;
+        }
     }
 }
 
 static void update_itf(cdc_t *cdc)
 {
+    cdc->interface = usb_cdc_itf(cdc->port);
+    if (cdc->interface < 0) {
+        cdc->connected = false;
+        return;
+    }
+
     cdc->connected = tud_cdc_n_connected(cdc->interface);
 
-    if (tud_cdc_n_available(cdc->interface)) {
-        uint8_t buf[48];
-        uint32_t count = tud_cdc_n_read(cdc->interface, buf, sizeof(buf));
-        for (int i = 0; i < count; i++) {
-            assemble_cmd(cdc, buf[i]);
+    while (tud_cdc_n_available(cdc->interface)) {
+        uint32_t room = RX_LEN - cdc->rx_len;
+        uint32_t count = tud_cdc_n_read(cdc->interface, cdc->rx + cdc->rx_len, room);
+        if (count == 0) {
+            break;
         }
+        usbstat_cdc_rx(cdc->port, count);
+        cdc->rx_len += count;
+        io_parse(cdc);
     }
 }
 
 #ifndef AZAMAI_BUILD
+/*
+ * Frames go out on a timer, the keepalive, which is 1ms unless the
+ * on_change mode stretches it. In that mode a change is sent as soon as
+ * touch_update() sees it, at most every min_gap_us, and any frame
+ * restarts the keepalive, so the average traffic doesn't go up.
+ */
+static struct {
+    uint64_t time;
+    uint64_t map;
+} touch_out;
+
+static bool touch_out_frame(uint64_t now)
+{
+    /*
+     * Latest wins: with a frame still waiting for the host, a new one is
+     * dropped, and retried next round with whatever the touch is by then.
+     * The FIFO is never cleared, TinyUSB may have taken half a frame.
+     */
+    int len = mai_hot.stamp ? STAMP_TOUCH_FRAME_LEN : TOUCH_FRAME_LEN;
+    if (mai_hot.serial_latest && (cdc_tx_queued(USB_PORT_TOUCH) >= len)) {
+        usbstat_cdc_stale(USB_PORT_TOUCH);
+        return false;
+    }
+
+    uint8_t report[STAMP_TOUCH_FRAME_LEN];
+    touch_out.time = now;
+    touch_out.map = touch_touchmap_delayed(mai_hot.delay_touch);
+    len = stamp_touch_frame(report, touch_out.map, now);
+    cdc_tx_write(USB_PORT_TOUCH, report, len);
+    cdc_tx_end(USB_PORT_TOUCH);
+    return true;
+}
+
 static void send_touch()
 {
-    if ((ctx.touch_interface == 0) | (!ctx.stat)) {
+    if ((ctx.touch_interface < 0) | (!ctx.stat)) {
         return;
     }
 
-    static uint64_t last_sent_time = 0;
     uint64_t now = time_us_64();
-    if (now - last_sent_time < 1000) {
+    if (now - touch_out.time < mai_hot.serial_keepalive) {
         return;
     }
-    last_sent_time = now;
+    touch_out_frame(now);
+}
 
+/* right after touch_update(), a change goes out now instead of next round */
+void io_touch_update()
+{
+    if ((ctx.touch_interface < 0) || !ctx.stat || !mai_hot.serial_on_change) {
+        return;
+    }
 
-    uint8_t report[9] = "(\0\0\0\0\0\0\0)";
-    uint64_t touch = touch_touchmap();
-    for (int i = 0; i < 7; i++) {
-        report[i + 1] = touch & 0x1f;
-        touch >>= 5;
+    uint64_t now = time_us_64();
+    if ((touch_touchmap_delayed(mai_hot.delay_touch) == touch_out.map) ||
+        (now - touch_out.time < mai_hot.serial_min_gap)) {
+        return;
+    }
+    if (touch_out_frame(now)) {
+        cdc_tx_flush(USB_PORT_TOUCH);
     }
-    tud_cdc_n_write(ctx.touch_interface, report, sizeof(report));
-    tud_cdc_n_write_flush(ctx.touch_interface);
 }
 #endif
 
@@ -379,10 +547,13 @@ void io_update()
 {
 #ifdef AZAMAI_BUILD
     update_itf(cdc + 1);
+    cdc_tx_flush(USB_PORT_LED);
 #else
     update_itf(cdc);
     update_itf(cdc + 1);
     send_touch();
+    cdc_tx_flush(USB_PORT_TOUCH);
+    cdc_tx_flush(USB_PORT_LED);
 #endif
 }
 
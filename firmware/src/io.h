@@ -8,5 +8,6 @@
 
 void io_update();
 bool io_is_active();
+void io_touch_update(); // classic only, right after touch_update()
 
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
@@ -9,6 +9,7 @@
 
 #include "pico/platform.h"
 #include "pico/stdio.h"
+#include "pico/stdio_usb.h"
 #include "pico/stdlib.h"
 #include "bsp/board.h"
 #include "pico/multicore.h"
@@ -44,6 +45,11 @@
 #include "commands.h"
 #include "io.h"
 #include "hid.h"
+#include "event.h"
+#include "sof.h"
+#include "telemetry.h"
+#include "usbstat.h"
+#include "cdc_tx.h"
 
 #define TASK_PRIORITY_HIGHEST (configMAX_PRIORITIES - 1)
 #define TASK_PRIORITY_HIGH    (configMAX_PRIORITIES - 2)
@@ -57,11 +63,14 @@ static void button_lights_clear()
     }
 }
 
+static event_sub_t lights_sub;
+static uint32_t lights_buttons;
+
 static void button_lights_rainbow()
 {
     static uint16_t loop = 0;
     loop++;
-    uint16_t buttons = button_read();
+    uint32_t buttons = lights_buttons;
     for (int i = 0; i < 8; i++) {
         uint8_t phase = (i * 256 + loop) / 8;
         uint32_t color;
@@ -76,6 +85,13 @@ static void button_lights_rainbow()
 
 static void run_lights()
 {
+    event_t event;
+    while (event_next(&lights_sub, &event)) {
+        if (event.source == EVENT_BUTTON) {
+            lights_buttons = event.state;
+        }
+    }
+
     static bool was_rainbow = true;
     bool go_rainbow = !io_is_active() && !aime_is_active();
 
@@ -89,23 +105,25 @@ static void run_lights()
 }
 
 
-const int aime_intf = 3;
 static void cdc_aime_putc(uint8_t byte)
 {
-    tud_cdc_n_write(aime_intf, &byte, 1);
-    tud_cdc_n_write_flush(aime_intf);
+    cdc_tx_put(USB_PORT_AIME, byte);
 }
 
 static void aime_run()
 {
-    if (tud_cdc_n_available(aime_intf)) {
+    int aime_intf = usb_cdc_itf(USB_PORT_AIME);
+    if ((aime_intf >= 0) && tud_cdc_n_available(aime_intf)) {
         uint8_t buf[32];
         uint32_t count = tud_cdc_n_read(aime_intf, buf, sizeof(buf));
+        usbstat_cdc_rx(USB_PORT_AIME, count);
 
         for (int i = 0; i < count; i++) {
             aime_feed(buf[i]);
         }
     }
+    /* responses come a byte at a time, they go out together */
+    cdc_tx_flush(USB_PORT_AIME);
 }
 static mutex_t core1_io_lock;
 static void core1_loop()
@@ -135,16 +153,30 @@ static void core0_loop()
         save_loop();
         cli_fps_count(0);
 
-        sleep_until(next_frame);
-        next_frame += 1000; // 1KHz
+        uint64_t wake = sof_next_wake();
+        if (wake) {
+            /* keep tud_task() going, so SOF callbacks come in on time */
+            while (time_us_64() < wake) {
+                tud_task();
+            }
+            next_frame = wake + 1000;
+        } else {
+            sleep_until(next_frame);
+            next_frame += 1000; // 1KHz
+        }
+
+        sof_ran();
+        telemetry_begin();
 
 #ifndef AZAMAI_BUILD
         touch_update();
+        io_touch_update();
 #endif
 
         button_update();
 
         hid_update();
+        telemetry_update();
     }
 }
 #else
@@ -160,17 +192,107 @@ void usbd_task()
     }
 }
 
+static TaskHandle_t io_task_handle;
+
+#define IO_WAKE_TICK (1 << 0)
+#define IO_WAKE_BUTTON (1 << 1)
+#define IO_WAKE_HID (1 << 2)
+
+static void io_notify_from_isr(uint32_t bits)
+{
+    BaseType_t woken = pdFALSE;
+    xTaskNotifyFromISR(io_task_handle, bits, eSetBits, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+static void io_button_irq()
+{
+    io_notify_from_isr(IO_WAKE_BUTTON);
+}
+
+/* usbd_task, a report went out */
+static void io_hid_complete()
+{
+    xTaskNotify(io_task_handle, IO_WAKE_HID, eSetBits);
+}
+
+static int64_t io_alarm(alarm_id_t id, void *user_data)
+{
+    io_notify_from_isr(IO_WAKE_TICK);
+    return 0;
+}
+
+/* a timeout is a tick too */
+static uint32_t io_wait(TickType_t timeout)
+{
+    uint32_t bits = 0;
+    if (!xTaskNotifyWait(0, UINT32_MAX, &bits, timeout)) {
+        return IO_WAKE_TICK;
+    }
+    return bits;
+}
+
 void io_task()
 {
     const TickType_t xFrequency = pdMS_TO_TICKS(1);
-    TickType_t xLastWakeTime = xTaskGetTickCount();
+    TickType_t next = xTaskGetTickCount();
+    alarm_id_t alarm = 0;
+    bool locked = false;
+    uint32_t wake_bits = IO_WAKE_TICK;
 
     while (1) {
+        if (!(wake_bits & IO_WAKE_TICK)) {
+            /* a button IRQ or a finished report between ticks: send what is
+               due, but leave sampling and the delay lines to the tick, and
+               the armed alarm as it is */
+            if (wake_bits & IO_WAKE_BUTTON) {
+                hid_update();
+            }
+            hid_flush();
+            TickType_t now = xTaskGetTickCount();
+            if (locked) {
+                wake_bits = io_wait(2 * xFrequency);
+            } else if ((int32_t)(next - now) > 0) {
+                wake_bits = io_wait(next - now);
+            } else {
+                wake_bits = IO_WAKE_TICK;
+            }
+            continue;
+        }
+
+        sof_ran();
+        telemetry_begin();
         io_update();
         button_update();
         hid_update();
-
-        vTaskDelayUntil(&xLastWakeTime, xFrequency);
+        hid_flush();
+        telemetry_update();
+
+        /* locked to the host's frames, the alarm wakes us just before SOF */
+        uint64_t wake = sof_next_wake();
+        if (wake) {
+            if (alarm > 0) {
+                cancel_alarm(alarm);
+            }
+            alarm = add_alarm_at(from_us_since_boot(wake), io_alarm, NULL, false);
+            locked = (alarm > 0);
+            if (locked) {
+                wake_bits = io_wait(2 * xFrequency);
+                next = xTaskGetTickCount();
+                continue;
+            }
+        }
+        locked = false;
+
+        /* keeps the 1ms cadence */
+        TickType_t now = xTaskGetTickCount();
+        if ((int32_t)(now - next) >= 0) {
+            next += xFrequency;
+            if ((int32_t)(now - next) >= 0) {
+                next = now + xFrequency;
+            }
+        }
+        wake_bits = io_wait(next - now);
     }
 }
 
@@ -202,7 +324,9 @@ void aime_task()
 void init_tasks()
 {
     xTaskCreate(usbd_task, "usbd", configMINIMAL_STACK_SIZE, NULL, TASK_PRIORITY_HIGHEST, NULL);
-    xTaskCreate(io_task, "io", configMINIMAL_STACK_SIZE, NULL, TASK_PRIORITY_HIGH, NULL);
+    xTaskCreate(io_task, "io", configMINIMAL_STACK_SIZE, NULL, TASK_PRIORITY_HIGH, &io_task_handle);
+    button_on_change(io_button_irq);
+    hid_on_complete(io_hid_complete);
     xTaskCreate(aime_task, "aime", configMINIMAL_STACK_SIZE, NULL, TASK_PRIORITY_LOW, NULL);
     xTaskCreate(cli_task, "cli", configMINIMAL_STACK_SIZE, NULL, TASK_PRIORITY_LOWEST, NULL);
 }
@@ -225,6 +349,16 @@ void vApplicationMallocFailedHook(void)
 }
 #endif
 
+/* Holding Service while plugging in always brings every port back */
+static uint8_t boot_usb_profile()
+{
+    bool level = gpio_get(button_real_gpio(SERVICE_BUTTON));
+    if (level == mai_cfg->tweak.aux_button_active_high) {
+        return USB_PROFILE_SERVICE;
+    }
+    return mai_cfg->usb.profile;
+}
+
 void init()
 {
 #ifndef AZAMAI_BUILD
@@ -233,11 +367,12 @@ void init()
     board_init();
 #endif
 
-    tusb_init();
-    stdio_init_all();
-
     config_init();
     mutex_init(&core1_io_lock);
+    event_init();
+    event_subscribe(&lights_sub, "lights");
+    hid_init();
+    telemetry_init();
 
 #ifdef AZAMAI_BUILD
     io_uart_init(TASK_PRIORITY_HIGH, TASK_PRIORITY_LOW);
@@ -250,6 +385,14 @@ void init()
     button_init();
     rgb_init();
 
+    usb_profile_select(boot_usb_profile());
+    tusb_init();
+    sof_init();
+    stdio_init_all();
+    if (usb_cdc_itf(USB_PORT_CLI) < 0) {
+        stdio_set_driver_enabled(&stdio_usb, false);
+    }
+
 #ifdef AZAMAI_BUILD
     nfc_init_spi(SPI_PORT, SPI_MISO, SPI_SCK, SPI_MOSI, SPI_NSS);
 #else
@@ -305,8 +448,10 @@ uint16_t tud_hid_get_report_cb(uint8_t itf, uint8_t report_id,
                                hid_report_type_t report_type, uint8_t *buffer,
                                uint16_t reqlen)
 {
-    printf("Get from USB %d-%d\n", report_id, report_type);
-    return 0;
+    if (report_type != HID_REPORT_TYPE_INPUT) {
+        return 0;
+    }
+    return hid_get_report(itf, report_id, buffer, reqlen);
 }
 
 // Invoked when received SET_REPORT control request or
@@ -167,6 +167,19 @@ bool mpr121_raw(uint8_t addr, uint16_t *raw, int num)
     return mpr121_read_many16(addr, MPR121_ELECTRODE_FILTERED_DATA_REG, raw, num);
 }
 
+bool mpr121_baseline(uint8_t addr, uint16_t *baseline, int num)
+{
+    uint8_t vals[num];
+    if (!mpr121_read_many(addr, MPR121_BASELINE_VALUE_REG, vals, num)) {
+        return false;
+    }
+    /* baseline registers keep the upper 8 of the 10 bits */
+    for (int i = 0; i < num; i++) {
+        baseline[i] = vals[i] << 2;
+    }
+    return true;
+}
+
 static uint8_t mpr121_stop(uint8_t addr)
 {
     uint8_t ecr = read_reg(addr, MPR121_ELECTRODE_CONFIG_REG);
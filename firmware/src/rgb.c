@@ -154,8 +154,11 @@ static void drive_led()
         }
     }
 #else
+    uint32_t save = mai_hot_lock();
+    uint8_t per[2] = { mai_hot.rgb_per[0], mai_hot.rgb_per[1] };
+    mai_hot_unlock(save);
     for (int i = 0; i < ARRAY_SIZE(rgb_buf); i++) {
-        int num = (i < 8) ? mai_cfg->rgb.per_button : mai_cfg->rgb.per_aux;
+        int num = per[i < 8 ? 0 : 1];
         for (int j = 0; j < num; j++) {
             pio_sm_put_blocking(pio0, 0, rgb_buf[i] << 8u);
         }
@@ -169,9 +172,11 @@ static inline uint32_t apply_level(uint32_t color)
     unsigned g = (color >> 8) & 0xff;
     unsigned b = color & 0xff;
 
-    r = r * mai_cfg->color.level / 255;
-    g = g * mai_cfg->color.level / 255;
-    b = b * mai_cfg->color.level / 255;
+    uint32_t save = mai_hot_lock();
+    r = mai_hot.level[r];
+    g = mai_hot.level[g];
+    b = mai_hot.level[b];
+    mai_hot_unlock(save);
 
     return r << 16 | g << 8 | b;
 }
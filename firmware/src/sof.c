@@ -0,0 +1,228 @@
+/*
+ * USB Frame Synchronization
+ * WHowe <github.com/whowechina>
+ *
+ * Every SOF gets a local timestamp in the USB interrupt, right behind
+ * TinyUSB's own handler. tud_sof_cb() runs later from tud_task(), on
+ * Azamai only as often as the usbd task gets scheduled, so it picks up
+ * the latched time of its frame and only falls back to its own clock
+ * when the latch has been overwritten. Either way a timestamp can only be
+ * late, never early. The estimate takes any earlier timestamp at once and
+ * creeps towards later ones very slowly, so it settles on the least
+ * delayed SOFs. The frame
+ * period is measured over SOF_SPAN frames, so the drift between the
+ * host's clock and our crystal is followed as well.
+ */
+
+#include "sof.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "hardware/irq.h"
+#include "hardware/structs/usb.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+
+#include "tusb.h"
+#include "config.h"
+
+#define FRAME_MASK 0x7ff // 11-bit frame number
+#define SOF_SPAN 1024 // frames per period measurement
+#define SOF_CREEP 256 // a late SOF moves the estimate by 1/SOF_CREEP
+#define SOF_LOCK_FRAMES 64 // frames seen before the estimate is used
+#define SOF_TIMEOUT_US 3000 // no SOF for this long: suspended or unplugged
+#define SOF_MIN_LEAD_US 50 // never schedule a wake closer than this
+#define SOF_LATCH 8 // frames tud_task() may fall behind the interrupt
+
+/* times in 1/256 us */
+static struct {
+    bool valid;
+    uint32_t frame;
+    uint64_t sof; // estimated SOF time of that frame
+    uint32_t period;
+    uint32_t seen; // consecutive frames
+    uint64_t last_us;
+    uint64_t span_us;
+    uint32_t span_frames;
+} sync;
+
+/* the round we last scheduled */
+static struct {
+    uint64_t wake;
+    uint64_t sof;
+} target;
+
+static sof_stat_t stat;
+
+/* SOF times taken in the USB interrupt, by frame number % SOF_LATCH */
+static struct {
+    uint32_t frame;
+    uint64_t us;
+} latch[SOF_LATCH];
+static uint32_t latch_frame;
+
+/*
+ * TinyUSB's handler has already read SOF_RD, which clears the SOF flag,
+ * so a new SOF shows up as a frame number we haven't latched yet. The
+ * first interrupt to see it is the SOF's own.
+ */
+static void sof_irq()
+{
+    uint32_t frame = usb_hw->sof_rd & FRAME_MASK;
+    if (frame == latch_frame) {
+        return;
+    }
+    latch_frame = frame;
+    latch[frame % SOF_LATCH].frame = frame;
+    latch[frame % SOF_LATCH].us = time_us_64();
+}
+
+void sof_init()
+{
+    for (int i = 0; i < SOF_LATCH; i++) {
+        latch[i].frame = UINT32_MAX;
+    }
+    latch_frame = usb_hw->sof_rd & FRAME_MASK;
+    irq_add_shared_handler(USBCTRL_IRQ, sof_irq,
+                           PICO_SHARED_IRQ_HANDLER_LOWEST_ORDER_PRIORITY);
+    tud_sof_cb_enable(true);
+}
+
+static void sync_restart(uint32_t frame, uint64_t now)
+{
+    sync.valid = true;
+    sync.frame = frame;
+    sync.sof = now << 8;
+    sync.period = 1000 << 8;
+    sync.seen = 0;
+    sync.last_us = now;
+    sync.span_us = now;
+    sync.span_frames = 0;
+    stat.resyncs++;
+}
+
+void tud_sof_cb(uint32_t frame_count)
+{
+    uint64_t now = time_us_64();
+    uint32_t frame = frame_count & FRAME_MASK;
+    stat.frames++;
+
+    uint32_t save = save_and_disable_interrupts();
+    if (latch[frame % SOF_LATCH].frame == frame) {
+        now = latch[frame % SOF_LATCH].us;
+    } else {
+        stat.unlatched++;
+    }
+    restore_interrupts(save);
+
+    if (!sync.valid || (now - sync.last_us > SOF_TIMEOUT_US)) {
+        sync_restart(frame, now);
+        return;
+    }
+
+    uint32_t frames = (frame - sync.frame) & FRAME_MASK;
+    if (frames == 0) {
+        return;
+    }
+
+    uint64_t predicted = sync.sof + (uint64_t)frames * sync.period;
+    int64_t late = (int64_t)((now << 8) - predicted);
+    if (late < 0) {
+        sync.sof = now << 8;
+    } else {
+        sync.sof = predicted + late / SOF_CREEP;
+        stat.late_sum += late >> 8;
+        if ((late >> 8) > stat.late_max) {
+            stat.late_max = late >> 8;
+        }
+    }
+    sync.frame = frame;
+    sync.seen += frames;
+    sync.last_us = now;
+
+    sync.span_frames += frames;
+    if (sync.span_frames >= SOF_SPAN) {
+        uint32_t period = ((now - sync.span_us) << 8) / sync.span_frames;
+        /* full speed frames are 1ms +-500ppm, anything else is garbage */
+        if ((period >= (999 << 8)) && (period <= (1001 << 8))) {
+            sync.period = period;
+        }
+        sync.span_us = now;
+        sync.span_frames = 0;
+    }
+}
+
+uint64_t sof_next_wake()
+{
+    uint32_t offset = mai_hot.sof_offset;
+    if (!offset) {
+        stat.locked = false;
+        return 0;
+    }
+
+    /* tud_sof_cb() may preempt us, take a consistent copy */
+    uint32_t save = save_and_disable_interrupts();
+    bool valid = sync.valid;
+    uint64_t sof = sync.sof;
+    uint32_t period = sync.period;
+    uint32_t seen = sync.seen;
+    uint64_t last_us = sync.last_us;
+    restore_interrupts(save);
+
+    uint64_t now = time_us_64();
+    stat.locked = valid && (seen >= SOF_LOCK_FRAMES) &&
+                  (now - last_us <= SOF_TIMEOUT_US);
+    stat.period_ns = period * 1000 / 256;
+    if (!stat.locked) {
+        target.wake = 0;
+        return 0;
+    }
+
+    /* the first SOF we can still make it to */
+    uint64_t earliest = (now + SOF_MIN_LEAD_US + offset) << 8;
+    uint64_t frames = (earliest - sof + period - 1) / period;
+    uint64_t next_sof = (sof + frames * period) >> 8;
+
+    target.sof = next_sof;
+    target.wake = next_sof - offset;
+    return target.wake;
+}
+
+void sof_ran()
+{
+    uint64_t now = time_us_64();
+    if (!target.wake || (now < target.wake)) {
+        return; /* not our round, something else woke it early */
+    }
+
+    int32_t phase = (int64_t)(target.sof - now);
+    if (!stat.runs || (phase < stat.phase_min)) {
+        stat.phase_min = phase;
+    }
+    if (!stat.runs || (phase > stat.phase_max)) {
+        stat.phase_max = phase;
+    }
+    stat.phase_sum += phase;
+    stat.runs++;
+    target.wake = 0;
+}
+
+const sof_stat_t *sof_stat()
+{
+    return &stat;
+}
+
+void sof_reset_stat()
+{
+    stat.frames = 0;
+    stat.unlatched = 0;
+    stat.resyncs = 0;
+    stat.late_max = 0;
+    stat.late_sum = 0;
+    stat.runs = 0;
+    stat.phase_min = 0;
+    stat.phase_max = 0;
+    stat.phase_sum = 0;
+}
@@ -0,0 +1,38 @@
+/*
+ * USB Frame Synchronization
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef SOF_H
+#define SOF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SOF_OFFSET_MAX 900 // us before SOF
+
+typedef struct {
+    bool locked;
+    uint32_t period_ns; // measured host frame period
+    uint32_t frames; // SOFs seen
+    uint32_t unlatched; // SOFs missing an interrupt timestamp
+    uint32_t resyncs;
+    uint32_t late_max; // SOF timestamp later than the estimate, us
+    uint64_t late_sum;
+    uint32_t runs; // rounds started by the SOF alarm
+    int32_t phase_min; // us before SOF when a round actually started
+    int32_t phase_max;
+    int64_t phase_sum;
+} sof_stat_t;
+
+void sof_init();
+
+/* Local time to start the next round, mai_hot.sof_offset us before the
+   next SOF, 0 if sync is off or not locked yet */
+uint64_t sof_next_wake();
+void sof_ran(); // call when a round starts, for the phase statistics
+
+const sof_stat_t *sof_stat();
+void sof_reset_stat();
+
+#endif
@@ -0,0 +1,43 @@
+/*
+ * Report Timestamps
+ * WHowe <github.com/whowechina>
+ *
+ * Stamped serial touch frames keep every byte between the brackets to 5
+ * bits like the touch bytes, so '(' and ')' still only show up as frame
+ * delimiters and a plain reader just sees a longer frame. The time goes
+ * out in 7 groups of 5 bits, the sequence in 2, low bits first.
+ */
+
+#include "stamp.h"
+
+#include "config.h"
+
+static uint32_t touch_seq;
+
+bool stamp_on()
+{
+    return mai_hot.stamp;
+}
+
+static uint8_t *put_5bits(uint8_t *pos, uint64_t value, int count)
+{
+    for (int i = 0; i < count; i++) {
+        *pos++ = value & 0x1f;
+        value >>= 5;
+    }
+    return pos;
+}
+
+int stamp_touch_frame(uint8_t *frame, uint64_t map, uint32_t time)
+{
+    uint8_t *pos = frame;
+    *pos++ = '(';
+    pos = put_5bits(pos, map, 7);
+    if (mai_hot.stamp) {
+        touch_seq++;
+        pos = put_5bits(pos, time, 7);
+        pos = put_5bits(pos, touch_seq, 2);
+    }
+    *pos++ = ')';
+    return pos - frame;
+}
@@ -0,0 +1,27 @@
+/*
+ * Report Timestamps
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef STAMP_H
+#define STAMP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Appended to reports with report.stamp on, time is time_us_32() */
+typedef struct __attribute__((packed)) {
+    uint32_t time_us;
+    uint32_t seq;
+} stamp_t;
+
+/* "(" + 7 touch bytes + 7 time bytes + 2 seq bytes + ")" */
+#define STAMP_TOUCH_FRAME_LEN 18
+#define TOUCH_FRAME_LEN 9
+
+bool stamp_on();
+
+/* Serial touch frame, stamped if report.stamp is on, returns its length */
+int stamp_touch_frame(uint8_t *frame, uint64_t map, uint32_t time);
+
+#endif
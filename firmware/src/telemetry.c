@@ -0,0 +1,129 @@
+/*
+ * Telemetry Stream over USB Vendor Bulk
+ * WHowe <github.com/whowechina>
+ *
+ * Each IO round makes one frame. A frame is only queued if the vendor
+ * FIFO has room for all of it, otherwise it's counted as dropped, so a
+ * slow host never stalls the IO loop and never gets a torn frame.
+ */
+
+#include "telemetry.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "hardware/timer.h"
+
+#include "tusb.h"
+#include "button.h"
+#include "event.h"
+
+#ifndef AZAMAI_BUILD
+#include "touch.h"
+#endif
+
+static struct {
+    uint8_t cmd;
+    uint32_t seq;
+    uint32_t begin;
+    uint32_t last_begin;
+    uint8_t sensor;
+    uint64_t touch;
+} ctx;
+
+static telemetry_stat_t stat;
+static event_sub_t telemetry_sub;
+
+void telemetry_init()
+{
+    event_subscribe(&telemetry_sub, "telemetry");
+}
+
+void telemetry_begin()
+{
+    ctx.last_begin = ctx.begin;
+    ctx.begin = time_us_32();
+}
+
+static void read_cmd()
+{
+    if (!tud_vendor_mounted()) {
+        ctx.cmd = 0;
+        return;
+    }
+    while (tud_vendor_available()) {
+        uint8_t cmd;
+        if (tud_vendor_read(&cmd, 1) == 1) {
+            ctx.cmd = cmd;
+        }
+    }
+    stat.streaming = ctx.cmd & TELEMETRY_CMD_STREAM;
+}
+
+static void track_touch()
+{
+    event_t event;
+    while (event_next(&telemetry_sub, &event)) {
+        if ((event.source == EVENT_TOUCH) || (event.source == EVENT_UART_TOUCH)) {
+            ctx.touch = event.state;
+        }
+    }
+}
+
+static void fill_sensor(telemetry_frame_t *frame)
+{
+    frame->sensor = TELEMETRY_NO_SENSOR;
+#ifndef AZAMAI_BUILD
+    if (!(ctx.cmd & TELEMETRY_CMD_SENSORS)) {
+        return;
+    }
+    /* one sensor per round, all three would take a few ms of I2C */
+    ctx.sensor = (ctx.sensor + 1) % 3;
+    uint16_t filtered[12];
+    uint16_t baseline[12];
+    if (touch_sensor_readout(ctx.sensor, filtered, baseline)) {
+        memcpy(frame->filtered, filtered, sizeof(filtered));
+        memcpy(frame->baseline, baseline, sizeof(baseline));
+        frame->sensor = ctx.sensor;
+    }
+#endif
+}
+
+void telemetry_update()
+{
+    track_touch();
+    read_cmd();
+    if (!stat.streaming) {
+        return;
+    }
+
+    telemetry_frame_t frame = {
+        .magic = TELEMETRY_MAGIC,
+        .version = TELEMETRY_VERSION,
+        .seq = ctx.seq++,
+        .time_us = ctx.begin,
+        .buttons = button_read(),
+        .touch = ctx.touch,
+    };
+    fill_sensor(&frame);
+    if (frame.seq && ctx.last_begin) {
+        uint32_t gap = ctx.begin - ctx.last_begin;
+        frame.gap_us = (gap > UINT16_MAX) ? UINT16_MAX : gap;
+    }
+    frame.round_us = time_us_32() - ctx.begin;
+    frame.dropped = stat.dropped;
+
+    if (tud_vendor_write_available() < sizeof(frame)) {
+        stat.dropped++;
+        return;
+    }
+    tud_vendor_write(&frame, sizeof(frame));
+    tud_vendor_write_flush();
+    stat.sent++;
+}
+
+const telemetry_stat_t *telemetry_stat()
+{
+    return &stat;
+}
@@ -0,0 +1,55 @@
+/*
+ * Telemetry Stream over USB Vendor Bulk
+ * WHowe <github.com/whowechina>
+ *
+ * Frames are little endian and packed, this header is shared with the
+ * host side reader in tools/telemetry.
+ *
+ * One frame per IO round, so the stream is capped at the 1 kHz loop,
+ * SOF paced or free running. Nothing in it is sampled any faster.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TELEMETRY_MAGIC 0x544d // "MT"
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_NO_SENSOR 0xff
+
+/* One byte written to the bulk OUT endpoint, 0 stops streaming */
+#define TELEMETRY_CMD_STREAM 0x01
+#define TELEMETRY_CMD_SENSORS 0x02 // MPR121 readouts, costs I2C time
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t sensor; // MPR121 the readouts are from, TELEMETRY_NO_SENSOR: none
+    uint32_t seq; // gaps are dropped frames
+    uint32_t time_us;
+    uint32_t buttons;
+    uint64_t touch;
+    uint16_t round_us; // time spent in this IO round
+    uint16_t gap_us; // since the round before, 0 in the first frame
+    uint32_t dropped; // no room in the endpoint FIFO, total
+    uint16_t filtered[12];
+    uint16_t baseline[12];
+} telemetry_frame_t;
+
+#ifndef __cplusplus
+void telemetry_init();
+void telemetry_begin(); // IO round starts
+void telemetry_update(); // IO round ends
+
+typedef struct {
+    bool streaming;
+    uint32_t sent;
+    uint32_t dropped;
+} telemetry_stat_t;
+
+const telemetry_stat_t *telemetry_stat();
+#endif
+
+#endif
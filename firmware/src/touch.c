@@ -15,16 +15,18 @@
 #include "bsp/board.h"
 #include "hardware/gpio.h"
 #include "hardware/i2c.h"
+#include "hardware/timer.h"
 
 #include "board_defs.h"
 
 #include "config.h"
+#include "event.h"
 #include "mpr121.h"
 
 static uint16_t touch[3];
 static unsigned touch_counts[36];
+static event_sub_t stat_sub;
 
-static uint8_t touch_map[] = TOUCH_MAP;
 
 void touch_init()
 {
@@ -38,7 +40,7 @@ void touch_init()
         mpr121_init(MPR121_BASE_ADDR + m);
     }
     touch_update_config();
-    memcpy(touch_map, mai_cfg->alt.touch, sizeof(touch_map));
+    event_subscribe(&stat_sub, "touch stat");
 }
 
 const char *touch_key_name(unsigned key)
@@ -80,7 +82,7 @@ int touch_key_by_name(const char *name)
 int touch_key_channel(unsigned key)
 {
     for (int i = 0; i < 36; i++) {
-        if (touch_map[i] == key) {
+        if (mai_hot.touch_map[i] == key) {
             return i;
         }
     }
@@ -90,7 +92,7 @@ int touch_key_channel(unsigned key)
 unsigned touch_key_from_channel(unsigned channel)
 {
     if (channel < 36) {
-        return touch_map[channel];
+        return mai_hot.touch_map[channel];
     }
     return 0xff;
 }
@@ -98,21 +100,25 @@ unsigned touch_key_from_channel(unsigned channel)
 void touch_set_map(unsigned sensor, unsigned key)
 {
     if (sensor < 36) {
-        touch_map[sensor] = key;
-        memcpy(mai_cfg->alt.touch, touch_map, sizeof(mai_cfg->alt.touch));
+        mai_cfg->alt.touch[sensor] = key;
         config_changed();
     }
 }
 
 static uint64_t touch_reading;
 
+/* Delay line for the serial touch stream, one entry per update */
+#define TOUCH_DELAY_LEN 64
+static uint64_t touch_history[TOUCH_DELAY_LEN];
+static uint32_t touch_head;
+
 static void remap_reading()
 {
     uint64_t map = 0;
     for (int m = 0; m < 3; m++) {
         for (int i = 0; i < 12; i++) {
             if (touch[m] & (1 << i)) {
-                map |= 1ULL << touch_map[m * 12 + i];
+                map |= 1ULL << mai_hot.touch_map[m * 12 + i];
             }
         }
     }
@@ -121,14 +127,16 @@ static void remap_reading()
 
 static void touch_stat()
 {
-    static uint64_t last_reading;
-
-    uint64_t just_touched = touch_reading & ~last_reading;
-    last_reading = touch_reading;
-
-    for (int i = 0; i < 34; i++) {
-        if (just_touched & (1ULL << i)) {
-            touch_counts[i]++;
+    event_t event;
+    while (event_next(&stat_sub, &event)) {
+        if (event.source != EVENT_TOUCH) {
+            continue;
+        }
+        uint64_t just_touched = event.state & event.changed;
+        for (int i = 0; i < 34; i++) {
+            if (just_touched & (1ULL << i)) {
+                touch_counts[i]++;
+            }
         }
     }
 }
@@ -139,7 +147,12 @@ void touch_update()
     touch[1] = mpr121_touched(MPR121_BASE_ADDR + 1) & 0x0fff;
     touch[2] = mpr121_touched(MPR121_BASE_ADDR + 2) & 0x0fff;
 
+    uint64_t last = touch_reading;
     remap_reading();
+    if (touch_reading != last) {
+        event_publish(EVENT_TOUCH, touch_reading, touch_reading ^ last, time_us_32());
+    }
+    touch_history[++touch_head % TOUCH_DELAY_LEN] = touch_reading;
 
     touch_stat();
 }
@@ -163,11 +176,21 @@ const uint16_t *touch_raw()
     }
 
     for (int i = 0; i < 34; i++) {
-        readout[touch_map[i]] = buf[i];
+        readout[mai_hot.touch_map[i]] = buf[i];
     }
     return readout;
 }
 
+/* channel order, not key order */
+bool touch_sensor_readout(unsigned sensor, uint16_t *filtered, uint16_t *baseline)
+{
+    if (sensor >= 3) {
+        return false;
+    }
+    uint8_t addr = MPR121_BASE_ADDR + sensor;
+    return mpr121_raw(addr, filtered, 12) && mpr121_baseline(addr, baseline, 12);
+}
+
 bool touch_touched(unsigned key)
 {
     if (key >= 34) {
@@ -181,6 +204,14 @@ uint64_t touch_touchmap()
     return touch_reading;
 }
 
+uint64_t touch_touchmap_delayed(uint8_t ticks)
+{
+    if (ticks >= TOUCH_DELAY_LEN) {
+        ticks = TOUCH_DELAY_LEN - 1;
+    }
+    return touch_history[(touch_head - ticks) % TOUCH_DELAY_LEN];
+}
+
 unsigned touch_count(unsigned key)
 {
     if (key >= 34) {
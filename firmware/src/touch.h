@@ -26,10 +26,12 @@ void touch_init();
 void touch_update();
 bool touch_touched(unsigned key);
 uint64_t touch_touchmap();
+uint64_t touch_touchmap_delayed(uint8_t ticks); // as it was ticks ago
 void touch_set_map(unsigned sensor, unsigned key);
 
 const uint16_t *touch_raw();
 bool touch_sensor_ok(unsigned i);
+bool touch_sensor_readout(unsigned sensor, uint16_t *filtered, uint16_t *baseline);
 
 void touch_update_config();
 unsigned touch_count(unsigned key);
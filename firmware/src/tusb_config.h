@@ -106,12 +106,15 @@ extern "C" {
 #define CFG_TUD_CDC 4
 #define CFG_TUD_MSC 0
 #define CFG_TUD_MIDI 0
-#define CFG_TUD_VENDOR 0
+#define CFG_TUD_VENDOR 1
 
 // HID buffer size Should be sufficient to hold ID (if any) + Data
 #define CFG_TUD_HID_EP_BUFSIZE 64
 
-#define CFG_TUD_VENDOR            0
+// Vendor FIFO size of TX and RX, TX holds a few ms of telemetry frames
+#define CFG_TUD_VENDOR_RX_BUFSIZE 64
+#define CFG_TUD_VENDOR_TX_BUFSIZE 1024
+#define CFG_TUD_VENDOR_EPSIZE     64
 
 // HID buffer size Should be sufficient to hold ID (if any) + Data
 #define CFG_TUD_HID_EP_BUFSIZE    64
@@ -9,13 +9,20 @@
 #include "hardware/gpio.h"
 #include "hardware/uart.h"
 #include "hardware/irq.h"
+#include "hardware/timer.h"
 #include "portmacro.h"
 #include "tusb.h"
 
 #include "board_defs.h"
+#include "event.h"
+#include "stamp.h"
+#include "cdc_tx.h"
+#include "usbstat.h"
+#include "usb_descriptors.h"
 
 #include <FreeRTOS.h>
 #include <queue.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <task.h>
 
@@ -39,18 +46,91 @@ void u2t_read_isr()
 	portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
 }
 
+static void cdc_forward(int itf, const uint8_t *data, int len)
+{
+	if (itf >= 0) {
+		cdc_tx_write(USB_PORT_TOUCH, data, len);
+	}
+}
+
+/*
+ * Touch frames are "(" + 7 bytes of 5 touch bits + ")". With report.stamp
+ * on, a frame is held back and goes out stamped, anything that turns out
+ * not to be a touch frame (command responses) goes out as it came.
+ */
+static void touch_frame_feed(int itf, uint8_t ch)
+{
+	static uint8_t raw[TOUCH_FRAME_LEN];
+	static int pos = -1; // -1: not in a frame
+	static bool held;
+	static uint64_t last;
+
+	if (ch == '(') {
+		if (held && (pos > 0)) {
+			cdc_forward(itf, raw, pos);
+		}
+		pos = 0;
+		held = stamp_on();
+	}
+	if (pos < 0) {
+		cdc_forward(itf, &ch, 1);
+		return;
+	}
+
+	raw[pos++] = ch;
+	if (!held) {
+		cdc_forward(itf, &ch, 1);
+	}
+	if ((ch != ')') && (pos < TOUCH_FRAME_LEN)) {
+		return;
+	}
+
+	int len = pos;
+	pos = -1;
+	if ((ch != ')') || (len != TOUCH_FRAME_LEN)) {
+		if (held) {
+			cdc_forward(itf, raw, len);
+		}
+		return;
+	}
+
+	uint32_t now = time_us_32();
+	uint64_t map = 0;
+	for (int i = 7; i >= 1; i--) {
+		map = (map << 5) | (raw[i] & 0x1f);
+	}
+	if (map != last) {
+		event_publish(EVENT_UART_TOUCH, map, map ^ last, now);
+		last = map;
+	}
+	if (held) {
+		uint8_t frame[STAMP_TOUCH_FRAME_LEN];
+		cdc_forward(itf, frame, stamp_touch_frame(frame, map, now));
+	}
+	cdc_tx_end(USB_PORT_TOUCH);
+}
+
+/* At 9600 baud a byte takes 1.04ms, so a frame is flushed once it closes,
+   anything else (or a frame cut short) once the line has been quiet for
+   a few bytes. The extra tick makes up for tick rounding. */
+#define U2T_IDLE_MS 3
+
 void u2t_write_task()
 {
+	const TickType_t idle = pdMS_TO_TICKS(U2T_IDLE_MS) + 1;
+	bool pending = false;
 	while (1) {
 		char ch;
-		if (xQueueReceive(u2t_queue, &ch, portMAX_DELAY) != pdTRUE) {
+		if (xQueueReceive(u2t_queue, &ch, pending ? idle : portMAX_DELAY) != pdTRUE) {
+			cdc_tx_flush(USB_PORT_TOUCH);
+			pending = false;
 			continue;
 		}
-		do {
-			tud_cdc_n_write_char(UART_ITF, ch);
-		} while (xQueueReceive(u2t_queue, &ch, 0) == pdTRUE);
-
-		tud_cdc_n_write_flush(UART_ITF);
+		touch_frame_feed(usb_cdc_itf(USB_PORT_TOUCH), ch);
+		pending = (ch != ')');
+		if (!pending) {
+			cdc_tx_flush(USB_PORT_TOUCH);
+		}
 	}
 }
 
@@ -59,7 +139,9 @@ void t2u_read_task()
 	const TickType_t xFrequency = pdMS_TO_TICKS(1);
 	while (1) {
 		char ch;
-		while (tud_cdc_n_available(UART_ITF) && (ch = tud_cdc_n_read_char(UART_ITF)) >= 0) {
+		int itf = usb_cdc_itf(USB_PORT_TOUCH);
+		while ((itf >= 0) && tud_cdc_n_available(itf) && (ch = tud_cdc_n_read_char(itf)) >= 0) {
+			usbstat_cdc_rx(USB_PORT_TOUCH, 1);
 			xQueueSend(t2u_queue, &ch, xFrequency);
 		}
 		vTaskDelay(xFrequency);
@@ -25,12 +25,14 @@
 
 #include "usb_descriptors.h"
 #include "pico/unique_id.h"
+#include "pico/stdio_usb.h"
+#include "pico/time.h"
 #include "tusb.h"
 
 tusb_desc_device_t desc_device_joy = {
     .bLength = sizeof(tusb_desc_device_t),
     .bDescriptorType = TUSB_DESC_DEVICE,
-    .bcdUSB = 0x0200,
+    .bcdUSB = 0x0200, // 0x0210 when there's a BOS for the vendor interface
     .bDeviceClass = 0x00,
     .bDeviceSubClass = 0x00,
     .bDeviceProtocol = 0x00,
@@ -83,72 +85,225 @@ uint8_t const* tud_hid_descriptor_report_cb(uint8_t itf)
 // Configuration Descriptor
 //--------------------------------------------------------------------+
 
-enum { ITF_NUM_JOY, ITF_NUM_NKRO,
-       ITF_NUM_CDC_CLI, ITF_NUM_CDC_CLI_DATA,
-       ITF_NUM_CDC_TOUCH, ITF_NUM_CDC_TOUCH_DATA,
-       ITF_NUM_CDC_LED, ITF_NUM_CDC_LED_DATA,
-       ITF_NUM_CDC_AIME, ITF_NUM_CDC_AIME_DATA,
-       ITF_NUM_TOTAL };
+/* Interface numbers must be contiguous, so the configuration descriptor is
+   put together from the functions the selected profile has */
+enum {
+    FUNC_JOY = 0x01,
+    FUNC_NKRO = 0x02,
+    FUNC_CDC = 0x04, // one bit for each usb_port from here
+    FUNC_VENDOR = 0x40, // telemetry
+    FUNC_ALL = 0x7f,
+};
+
+static const struct {
+    const char *name;
+    uint8_t funcs;
+} profiles[USB_PROFILE_NUM] = {
+    [USB_PROFILE_SERVICE] = { "service", FUNC_ALL },
+    [USB_PROFILE_GAME] = { "game",
+        FUNC_JOY | (FUNC_CDC << USB_PORT_TOUCH) | (FUNC_CDC << USB_PORT_LED) },
+    [USB_PROFILE_GAME_NFC] = { "nfc",
+        FUNC_JOY | (FUNC_CDC << USB_PORT_TOUCH) | (FUNC_CDC << USB_PORT_LED) |
+        (FUNC_CDC << USB_PORT_AIME) },
+};
 
-#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN +         \
-                          TUD_HID_INOUT_DESC_LEN * 1 +  \
-                          TUD_HID_DESC_LEN * 1 +        \
-                          TUD_CDC_DESC_LEN * 4)
+#define CONFIG_MAX_LEN (TUD_CONFIG_DESC_LEN +           \
+                        TUD_HID_INOUT_DESC_LEN * 1 +    \
+                        TUD_HID_DESC_LEN * 1 +          \
+                        TUD_CDC_DESC_LEN * USB_PORT_NUM + \
+                        TUD_VENDOR_DESC_LEN)
 
 #define EPNUM_JOY 0x81
 #define EPNUM_OUTPUT 0x01
 #define EPNUM_KEY 0x82
+#define EPNUM_VENDOR_OUT 0x0b
+#define EPNUM_VENDOR_IN 0x8b
+
+/* notification, out, in; ports keep their endpoints in every profile */
+static const uint8_t cdc_eps[USB_PORT_NUM][3] = {
+    { 0x83, 0x04, 0x84 }, // CLI
+    { 0x85, 0x06, 0x86 }, // Touch
+    { 0x87, 0x08, 0x88 }, // LED
+    { 0x89, 0x0a, 0x8a }, // AIME
+};
 
-#define EPNUM_CDC_CLI_NOTIF 0x83
-#define EPNUM_CDC_CLI_OUT   0x04
-#define EPNUM_CDC_CLI_IN    0x84
+//--------------------------------------------------------------------+
+// BOS and MS OS 2.0 Descriptors, so Windows binds WinUSB to telemetry
+//--------------------------------------------------------------------+
 
-#define EPNUM_CDC_TOUCH_NOTIF 0x85
-#define EPNUM_CDC_TOUCH_OUT 0x06
-#define EPNUM_CDC_TOUCH_IN  0x86
+#define VENDOR_REQUEST_MICROSOFT 1
+#define BOS_TOTAL_LEN (TUD_BOS_DESC_LEN + TUD_BOS_MICROSOFT_OS_DESC_LEN)
+#define MS_OS_20_DESC_LEN 0xb2
+#define MS_OS_20_VENDOR_ITF_POS 22 // bFirstInterface of the function subset
 
-#define EPNUM_CDC_LED_NOTIF 0x87
-#define EPNUM_CDC_LED_OUT 0x08
-#define EPNUM_CDC_LED_IN  0x88
+static uint8_t const desc_bos[] = {
+    // total length, number of device caps
+    TUD_BOS_DESCRIPTOR(BOS_TOTAL_LEN, 1),
+    // MS OS 2.0 descriptor set length, vendor code
+    TUD_BOS_MS_OS_20_DESCRIPTOR(MS_OS_20_DESC_LEN, VENDOR_REQUEST_MICROSOFT),
+};
 
-#define EPNUM_CDC_AIME_NOTIF 0x89
-#define EPNUM_CDC_AIME_OUT 0x0a
-#define EPNUM_CDC_AIME_IN  0x8a
+uint8_t const *tud_descriptor_bos_cb(void)
+{
+    return desc_bos;
+}
 
-uint8_t const desc_configuration_joy[] = {
-    // Config number, interface count, string index, total length, attribute,
-    // power in mA
-    TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN,
-                          TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 200),
+static uint8_t desc_ms_os_20[] = {
+    // Set header: length, type, windows version, total length
+    U16_TO_U8S_LE(0x000A), U16_TO_U8S_LE(MS_OS_20_SET_HEADER_DESCRIPTOR),
+    U32_TO_U8S_LE(0x06030000), U16_TO_U8S_LE(MS_OS_20_DESC_LEN),
+
+    // Configuration subset header: length, type, configuration index,
+    // reserved, configuration total length
+    U16_TO_U8S_LE(0x0008), U16_TO_U8S_LE(MS_OS_20_SUBSET_HEADER_CONFIGURATION),
+    0, 0, U16_TO_U8S_LE(MS_OS_20_DESC_LEN - 0x0A),
+
+    // Function subset header: length, type, first interface (patched when
+    // the profile is selected), reserved, subset length
+    U16_TO_U8S_LE(0x0008), U16_TO_U8S_LE(MS_OS_20_SUBSET_HEADER_FUNCTION),
+    0, 0, U16_TO_U8S_LE(MS_OS_20_DESC_LEN - 0x0A - 0x08),
+
+    // Compatible ID: length, type, compatible ID, sub compatible ID
+    U16_TO_U8S_LE(0x0014), U16_TO_U8S_LE(MS_OS_20_FEATURE_COMPATBLE_ID),
+    'W', 'I', 'N', 'U', 'S', 'B', 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+
+    // Registry property: length, type
+    U16_TO_U8S_LE(MS_OS_20_DESC_LEN - 0x0A - 0x08 - 0x08 - 0x14),
+    U16_TO_U8S_LE(MS_OS_20_FEATURE_REG_PROPERTY),
+    // REG_MULTI_SZ, property name length, name
+    U16_TO_U8S_LE(0x0007), U16_TO_U8S_LE(0x002A),
+    'D', 0, 'e', 0, 'v', 0, 'i', 0, 'c', 0, 'e', 0, 'I', 0, 'n', 0, 't', 0,
+    'e', 0, 'r', 0, 'f', 0, 'a', 0, 'c', 0, 'e', 0, 'G', 0, 'U', 0, 'I', 0,
+    'D', 0, 's', 0, 0, 0,
+    // property data length, data
+    U16_TO_U8S_LE(0x0050),
+    '{', 0, '6', 0, 'E', 0, '4', 0, 'D', 0, '2', 0, 'A', 0, '1', 0, '0', 0,
+    '-', 0, '3', 0, 'B', 0, '5', 0, '8', 0, '-', 0, '4', 0, 'C', 0, '7', 0,
+    '1', 0, '-', 0, '9', 0, 'A', 0, '0', 0, 'E', 0, '-', 0, '5', 0, 'D', 0,
+    '2', 0, 'C', 0, '8', 0, 'F', 0, '4', 0, '1', 0, '7', 0, 'B', 0, '3', 0,
+    '6', 0, '}', 0, 0, 0, 0, 0,
+};
+
+TU_VERIFY_STATIC(sizeof(desc_ms_os_20) == MS_OS_20_DESC_LEN, "Incorrect size");
+
+bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage,
+                                tusb_control_request_t const *request)
+{
+    if ((stage != CONTROL_STAGE_SETUP) ||
+        (request->bmRequestType_bit.type != TUSB_REQ_TYPE_VENDOR) ||
+        (request->bRequest != VENDOR_REQUEST_MICROSOFT) ||
+        (request->wIndex != 7)) {
+        return stage != CONTROL_STAGE_SETUP;
+    }
+    return tud_control_xfer(rhport, request, desc_ms_os_20, MS_OS_20_DESC_LEN);
+}
+
+static uint8_t desc_configuration[CONFIG_MAX_LEN];
+static uint8_t profile_selected;
+static int8_t cdc_itf[USB_PORT_NUM];
+
+#define DESC_APPEND(pos, ...)                     \
+    do {                                          \
+        const uint8_t chunk[] = { __VA_ARGS__ };  \
+        memcpy(pos, chunk, sizeof(chunk));        \
+        pos += sizeof(chunk);                     \
+    } while (0)
+
+void usb_profile_select(uint8_t profile)
+{
+    if (profile >= USB_PROFILE_NUM) {
+        profile = USB_PROFILE_SERVICE;
+    }
+    profile_selected = profile;
+    uint8_t funcs = profiles[profile].funcs;
+
+    uint8_t itf = 0;
+    uint8_t *pos = desc_configuration + TUD_CONFIG_DESC_LEN;
 
     // Interface number, string index, protocol, report descriptor len, EP In
     // address, size & polling interval
-    TUD_HID_INOUT_DESCRIPTOR(ITF_NUM_JOY, 4, HID_ITF_PROTOCOL_NONE,
-                       sizeof(desc_hid_report_joy), EPNUM_OUTPUT, EPNUM_JOY,
-                       CFG_TUD_HID_EP_BUFSIZE, 1),
+    DESC_APPEND(pos, TUD_HID_INOUT_DESCRIPTOR(itf, 4, HID_ITF_PROTOCOL_NONE,
+                     sizeof(desc_hid_report_joy), EPNUM_OUTPUT, EPNUM_JOY,
+                     CFG_TUD_HID_EP_BUFSIZE, 1));
+    itf++;
+
+    if (funcs & FUNC_NKRO) {
+        DESC_APPEND(pos, TUD_HID_DESCRIPTOR(itf, 5, HID_ITF_PROTOCOL_NONE,
+                         sizeof(desc_hid_report_nkro), EPNUM_KEY,
+                         CFG_TUD_HID_EP_BUFSIZE, 1));
+        itf++;
+    }
 
-    TUD_HID_DESCRIPTOR(ITF_NUM_NKRO, 5, HID_ITF_PROTOCOL_NONE,
-                       sizeof(desc_hid_report_nkro), EPNUM_KEY,
-                       CFG_TUD_HID_EP_BUFSIZE, 1),
+    int cdc = 0;
+    for (int port = 0; port < USB_PORT_NUM; port++) {
+        if (!(funcs & (FUNC_CDC << port))) {
+            cdc_itf[port] = -1;
+            continue;
+        }
+        DESC_APPEND(pos, TUD_CDC_DESCRIPTOR(itf, 6 + port, cdc_eps[port][0],
+                         8, cdc_eps[port][1], cdc_eps[port][2], 64));
+        itf += 2;
+        cdc_itf[port] = cdc++;
+    }
 
-    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC_CLI, 6, EPNUM_CDC_CLI_NOTIF,
-                       8, EPNUM_CDC_CLI_OUT, EPNUM_CDC_CLI_IN, 64),
+    desc_device_joy.bcdUSB = 0x0200;
+    if (funcs & FUNC_VENDOR) {
+        DESC_APPEND(pos, TUD_VENDOR_DESCRIPTOR(itf, 10, EPNUM_VENDOR_OUT,
+                         EPNUM_VENDOR_IN, 64));
+        desc_ms_os_20[MS_OS_20_VENDOR_ITF_POS] = itf;
+        desc_device_joy.bcdUSB = 0x0210;
+        itf++;
+    }
 
-    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC_TOUCH, 7, EPNUM_CDC_TOUCH_NOTIF,
-                       8, EPNUM_CDC_TOUCH_OUT, EPNUM_CDC_TOUCH_IN, 64),
+    uint16_t len = pos - desc_configuration;
+    pos = desc_configuration;
+    // Config number, interface count, string index, total length, attribute,
+    // power in mA
+    DESC_APPEND(pos, TUD_CONFIG_DESCRIPTOR(1, itf, 0, len,
+                     TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 200));
+}
 
-    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC_LED, 8, EPNUM_CDC_LED_NOTIF,
-                       8, EPNUM_CDC_LED_OUT, EPNUM_CDC_LED_IN, 64),
+void usb_profile_apply(uint8_t profile)
+{
+    tud_disconnect();
+    sleep_ms(20);
+    usb_profile_select(profile);
+    stdio_set_driver_enabled(&stdio_usb, usb_cdc_itf(USB_PORT_CLI) >= 0);
+    tud_connect();
+}
 
-    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC_AIME, 9, EPNUM_CDC_AIME_NOTIF,
-                       8, EPNUM_CDC_AIME_OUT, EPNUM_CDC_AIME_IN, 64),
-};
+uint8_t usb_profile()
+{
+    return profile_selected;
+}
+
+const char *usb_profile_name(uint8_t profile)
+{
+    if (profile >= USB_PROFILE_NUM) {
+        return "?";
+    }
+    return profiles[profile].name;
+}
+
+int usb_cdc_itf(int port)
+{
+    if ((port < 0) || (port >= USB_PORT_NUM)) {
+        return -1;
+    }
+    return cdc_itf[port];
+}
+
+bool usb_has_nkro()
+{
+    return profiles[profile_selected].funcs & FUNC_NKRO;
+}
 
 // Invoked when received GET CONFIGURATION DESCRIPTOR
 // Application return pointer to descriptor
 // Descriptor contents must exist long enough for transfer to complete
 uint8_t const* tud_descriptor_configuration_cb(uint8_t index) {
-    return desc_configuration_joy;
+    return desc_configuration;
 }
 
 //--------------------------------------------------------------------+
@@ -169,6 +324,7 @@ static const char *string_desc_arr[] = {
     "Azamai Touch Port",
     "Azamai LED Port",
     "Azamai AIME Port",
+    "Azamai Telemetry",
 };
 
 // Invoked when received GET STRING DESCRIPTOR request
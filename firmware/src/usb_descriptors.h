@@ -9,6 +9,31 @@ enum {
     REPORT_ID_OUTPUT = 16,
 };
 
+enum usb_port {
+    USB_PORT_CLI = 0,
+    USB_PORT_TOUCH,
+    USB_PORT_LED,
+    USB_PORT_AIME,
+    USB_PORT_NUM,
+};
+
+enum usb_profile {
+    USB_PROFILE_SERVICE = 0, // everything
+    USB_PROFILE_GAME, // IO4, touch and LED
+    USB_PROFILE_GAME_NFC, // IO4, touch, LED and AIME
+    USB_PROFILE_NUM,
+};
+
+/* Builds the descriptors, re-enumerate for it to take effect */
+void usb_profile_select(uint8_t profile);
+void usb_profile_apply(uint8_t profile); // re-enumerates
+uint8_t usb_profile();
+const char *usb_profile_name(uint8_t profile);
+
+/* CDC instance of a port, -1 if the running profile doesn't have it */
+int usb_cdc_itf(int port);
+bool usb_has_nkro(); // the running profile has the keyboard interface
+
 // because they are missing from tusb_hid.h
 #define HID_STRING_INDEX(x) HID_REPORT_ITEM(x, 7, RI_TYPE_LOCAL, 1)
 #define HID_STRING_INDEX_N(x, n) HID_REPORT_ITEM(x, 7, RI_TYPE_LOCAL, n)
@@ -0,0 +1,111 @@
+/*
+ * USB Transport Statistics
+ * WHowe <github.com/whowechina>
+ *
+ * Plain counters bumped wherever reports and CDC bytes meet the USB stack.
+ * They are updated from more than one task without a lock, an increment
+ * lost now and then doesn't matter for what they are for.
+ */
+
+#include "usbstat.h"
+
+#include <string.h>
+
+#include "hardware/timer.h"
+
+#include "usb_descriptors.h"
+
+static const uint16_t gap_bounds[] = USBSTAT_GAP_BOUNDS;
+
+static struct {
+    usbstat_hid_t stat;
+    uint32_t last_sent;
+} hid[2];
+
+static usbstat_cdc_t cdc[USB_PORT_NUM];
+
+void usbstat_hid_busy(int itf)
+{
+    if ((itf >= 0) && (itf < 2)) {
+        hid[itf].stat.busy++;
+    }
+}
+
+void usbstat_hid_failed(int itf)
+{
+    if ((itf >= 0) && (itf < 2)) {
+        hid[itf].stat.failed++;
+    }
+}
+
+void usbstat_hid_sent(int itf)
+{
+    if ((itf < 0) || (itf >= 2)) {
+        return;
+    }
+
+    usbstat_hid_t *stat = &hid[itf].stat;
+    uint32_t now = time_us_32();
+    if (stat->sent > 0) {
+        uint32_t gap = now - hid[itf].last_sent;
+        int bucket = 0;
+        while ((bucket < USBSTAT_GAP_HIST_NUM - 1) &&
+               (gap >= gap_bounds[bucket])) {
+            bucket++;
+        }
+        stat->hist[bucket]++;
+        if (gap > stat->max_gap_us) {
+            stat->max_gap_us = gap;
+        }
+    }
+    stat->sent++;
+    hid[itf].last_sent = now;
+}
+
+void usbstat_cdc_rx(int port, uint32_t bytes)
+{
+    if ((port >= 0) && (port < USB_PORT_NUM)) {
+        cdc[port].rx_bytes += bytes;
+    }
+}
+
+void usbstat_cdc_tx(int port, uint32_t asked, uint32_t written)
+{
+    if ((port < 0) || (port >= USB_PORT_NUM)) {
+        return;
+    }
+    cdc[port].writes++;
+    cdc[port].tx_bytes += written;
+    if (written < asked) {
+        cdc[port].tx_full += asked - written;
+    }
+}
+
+void usbstat_cdc_stale(int port)
+{
+    if ((port >= 0) && (port < USB_PORT_NUM)) {
+        cdc[port].stale++;
+    }
+}
+
+const usbstat_hid_t *usbstat_hid(int itf)
+{
+    if ((itf < 0) || (itf >= 2)) {
+        return NULL;
+    }
+    return &hid[itf].stat;
+}
+
+const usbstat_cdc_t *usbstat_cdc(int port)
+{
+    if ((port < 0) || (port >= USB_PORT_NUM)) {
+        return NULL;
+    }
+    return &cdc[port];
+}
+
+void usbstat_reset()
+{
+    memset(hid, 0, sizeof(hid));
+    memset(cdc, 0, sizeof(cdc));
+}
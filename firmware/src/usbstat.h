@@ -0,0 +1,44 @@
+/*
+ * USB Transport Statistics
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef USBSTAT_H
+#define USBSTAT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Interval between reports going out, histogram buckets end at these (us) */
+#define USBSTAT_GAP_BOUNDS { 500, 1000, 2000, 4000, 8000, 16000, 32000 }
+#define USBSTAT_GAP_HIST_NUM 8
+
+typedef struct {
+    uint32_t sent;
+    uint32_t busy; // a report was due but the endpoint was not ready
+    uint32_t failed; // the stack refused a report
+    uint32_t max_gap_us;
+    uint32_t hist[USBSTAT_GAP_HIST_NUM];
+} usbstat_hid_t;
+
+typedef struct {
+    uint32_t rx_bytes;
+    uint32_t tx_bytes;
+    uint32_t tx_full; // bytes the TX FIFO had no room for
+    uint32_t writes;
+    uint32_t stale; // frames dropped, the host was behind
+} usbstat_cdc_t;
+
+/* HID instance 0: joy, 1: nkro; CDC by enum usb_port */
+void usbstat_hid_busy(int itf);
+void usbstat_hid_failed(int itf);
+void usbstat_hid_sent(int itf);
+void usbstat_cdc_rx(int port, uint32_t bytes);
+void usbstat_cdc_tx(int port, uint32_t asked, uint32_t written);
+void usbstat_cdc_stale(int port);
+
+const usbstat_hid_t *usbstat_hid(int itf);
+const usbstat_cdc_t *usbstat_cdc(int port);
+void usbstat_reset();
+
+#endif
@@ -0,0 +1,81 @@
+/*
+ * LED traffic throughput of the io.c protocol engine
+ *
+ * Usage: io_bench [capture] [seconds]
+ *   capture: raw bytes the game sent to the LED port, as recorded with
+ *            any serial sniffer. Without it, a synthetic stream shaped
+ *            like game traffic is used: every button colored one by one
+ *            and as a range, plus the cabinet lights, with the odd
+ *            escaped byte.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "harness.h"
+
+#define PACKET 64 // full speed bulk packet
+
+static uint8_t stream[1 << 20];
+
+static size_t synthetic()
+{
+    size_t len = 0;
+    for (int tick = 0; len + 512 < sizeof(stream); tick++) {
+        for (int i = 0; i < 8; i++) {
+            const uint8_t rgb[] = { i, tick * 7 + i, 0xe0 - i, tick };
+            len += harness_led_frame(stream + len, 1, 2, 0x31, rgb, sizeof(rgb));
+        }
+        const uint8_t range[] = { 0, 8, 0, tick, 0xd0, 0x40 };
+        len += harness_led_frame(stream + len, 1, 2, 0x32, range, sizeof(range));
+        const uint8_t fade[] = { 0, 8, 0, 0x10, 0x20, 0x30, 4 };
+        len += harness_led_frame(stream + len, 1, 2, 0x33, fade, sizeof(fade));
+        const uint8_t fet[] = { tick, 0x80, 0xff };
+        len += harness_led_frame(stream + len, 1, 2, 0x39, fet, sizeof(fet));
+    }
+    return len;
+}
+
+static size_t load(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    size_t len = fread(stream, 1, sizeof(stream), f);
+    fclose(f);
+    return len;
+}
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t len = (argc > 1) ? load(argv[1]) : synthetic();
+    double seconds = (argc > 2) ? atof(argv[2]) : 2.0;
+
+    harness_reset();
+    double start = now_sec();
+    double elapsed;
+    uint64_t bytes = 0;
+    do {
+        harness_feed(HARNESS_PORT_LED, stream, len, PACKET);
+        bytes += len;
+        elapsed = now_sec() - start;
+    } while (elapsed < seconds);
+
+    uint64_t frames = harness_tx_frames(HARNESS_PORT_LED);
+    printf("%s: %zu bytes per pass, %.2f s\n",
+           (argc > 1) ? argv[1] : "synthetic", len, elapsed);
+    printf("  %.0f frames/s, %.1f MB/s in, %.1f ns/frame\n",
+           frames / elapsed, bytes / elapsed / 1e6, elapsed * 1e9 / frames);
+    return 0;
+}
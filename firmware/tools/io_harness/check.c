@@ -0,0 +1,320 @@
+/*
+ * Regression checks for the io.c protocol engine, run by ctest
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "harness.h"
+#include "config.h"
+#include "usbstat.h"
+#include "hid.h"
+
+static int failures;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("  FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+/* unescapes the n-th response frame on the LED port, returns its length */
+static int led_response(int index, uint8_t *out)
+{
+    uint32_t len;
+    const uint8_t *tx = harness_tx(HARNESS_PORT_LED, &len);
+    int frame = -1;
+    int n = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        if (tx[i] == LED_SYNC) {
+            frame++;
+            continue;
+        }
+        if (frame != index) {
+            continue;
+        }
+        uint8_t c = tx[i];
+        if ((c == LED_ESCAPE) && (i + 1 < len)) {
+            c = tx[++i] + 1;
+        }
+        out[n++] = c;
+    }
+    if (n == 0) {
+        return 0;
+    }
+    uint8_t sum = 0;
+    for (int i = 0; i < n - 1; i++) {
+        sum += out[i];
+    }
+    return (sum == out[n - 1]) ? n : -1;
+}
+
+static void check_set_color(uint32_t chunk)
+{
+    harness_reset();
+    const uint8_t rgb[] = { 3, 0x12, 0x34, 0x56 };
+    uint8_t frame[64];
+    int len = harness_led_frame(frame, 1, 2, 0x31, rgb, sizeof(rgb));
+    harness_feed(HARNESS_PORT_LED, frame, len, chunk);
+
+    CHECK(harness_button_color(3) == 0x123456);
+    uint8_t resp[64];
+    int n = led_response(0, resp);
+    CHECK(n == 7); // dst src len status cmd report checksum
+    CHECK((resp[0] == 2) && (resp[1] == 1) && (resp[4] == 0x31));
+    CHECK(harness_tx_frames(HARNESS_PORT_LED) == 1);
+}
+
+static void check_escapes(uint32_t chunk)
+{
+    harness_reset();
+    const uint8_t rgb[] = { 5, LED_SYNC, LED_ESCAPE, LED_SYNC - 1 };
+    uint8_t frame[64];
+    int len = harness_led_frame(frame, LED_ESCAPE, LED_SYNC, 0x31, rgb, sizeof(rgb));
+    harness_feed(HARNESS_PORT_LED, frame, len, chunk);
+
+    CHECK(harness_button_color(5) == ((LED_SYNC << 16) | (LED_ESCAPE << 8) | (LED_SYNC - 1)));
+    uint8_t resp[64];
+    CHECK(led_response(0, resp) == 7);
+    CHECK((resp[0] == LED_SYNC) && (resp[1] == LED_ESCAPE));
+}
+
+static void check_bad_frames()
+{
+    harness_reset();
+    const uint8_t rgb[] = { 1, 0xaa, 0xbb, 0xcc };
+    uint8_t stream[256];
+    int len = 0;
+
+    /* garbage, wrong checksum, cut short, oversized, then a good one */
+    memcpy(stream, "\x01\x02{}garbage", 11);
+    len += 11;
+    int bad = harness_led_frame(stream + len, 1, 2, 0x31, rgb, sizeof(rgb));
+    stream[len + bad - 1] ^= 0x01;
+    len += bad;
+    len += harness_led_frame(stream + len, 1, 2, 0x31, rgb, sizeof(rgb)) - 3;
+    memcpy(stream + len, "\xe0\x01\x02\xc8\x31\x00\x00", 7);
+    len += 7;
+    len += harness_led_frame(stream + len, 1, 2, 0x31, rgb, sizeof(rgb));
+
+    harness_feed(HARNESS_PORT_LED, stream, len, 0);
+    CHECK(harness_button_color(1) == 0xaabbcc);
+    CHECK(harness_tx_frames(HARNESS_PORT_LED) == 1);
+}
+
+static void check_burst()
+{
+    harness_reset();
+    uint8_t stream[1024];
+    int len = 0;
+    for (int i = 0; i < 8; i++) {
+        const uint8_t rgb[] = { i, i, 0xe0, 0xd0 };
+        len += harness_led_frame(stream + len, 1, 2, 0x31, rgb, sizeof(rgb));
+    }
+    len += harness_led_frame(stream + len, 1, 2, 0xf0, NULL, 0);
+
+    for (uint32_t chunk = 0; chunk < 80; chunk += 7) {
+        harness_reset();
+        harness_feed(HARNESS_PORT_LED, stream, len, chunk);
+        CHECK(harness_tx_frames(HARNESS_PORT_LED) == 9);
+        CHECK(harness_button_color(7) == 0x07e0d0);
+        uint8_t resp[64];
+        int n = led_response(8, resp);
+        CHECK(n == 17);
+        CHECK(memcmp(resp + 6, "15070-04", 8) == 0);
+    }
+}
+
+static void check_touch()
+{
+    harness_reset();
+    const uint8_t cmds[] = "{L1r5}{R2k7}{junk}{R2";
+    harness_feed(HARNESS_PORT_TOUCH, cmds, sizeof(cmds) - 1, 3);
+
+    uint32_t len;
+    const uint8_t *tx = harness_tx(HARNESS_PORT_TOUCH, &len);
+    CHECK(len == 12);
+    CHECK(memcmp(tx, "(L1r5)(R2k7)", 12) == 0);
+}
+
+/* {STAT} turns the touch stream on, io.c keeps it on from then */
+static void touch_stat_on()
+{
+    const uint8_t cmd[] = "{STAT}";
+    harness_feed(HARNESS_PORT_TOUCH, cmd, sizeof(cmd) - 1, 0);
+}
+
+static void check_serial_latest()
+{
+    mai_hot.stamp = 0;
+    mai_hot.serial_on_change = 0;
+    mai_hot.serial_keepalive = 1000;
+    mai_hot.serial_min_gap = 0;
+
+    /* the host takes nothing for 20 rounds, frames pile up in the FIFO */
+    harness_reset();
+    mai_hot.serial_latest = 0;
+    harness_hold(HARNESS_PORT_TOUCH, true);
+    touch_stat_on();
+    harness_run(20000, 1000);
+    CHECK(harness_tx_bytes(HARNESS_PORT_TOUCH) == HARNESS_FIFO_SIZE);
+    CHECK(usbstat_cdc(HARNESS_PORT_TOUCH)->stale == 0);
+
+    /* latest wins: one frame waits, the others are dropped */
+    harness_reset();
+    mai_hot.serial_latest = 1;
+    harness_hold(HARNESS_PORT_TOUCH, true);
+    touch_stat_on();
+    harness_run(20000, 1000);
+    CHECK(harness_tx_bytes(HARNESS_PORT_TOUCH) == 9);
+    CHECK(usbstat_cdc(HARNESS_PORT_TOUCH)->stale == 19);
+
+    /* once the host catches up, the next round goes out */
+    harness_drain(HARNESS_PORT_TOUCH);
+    harness_run(1000, 1000);
+    CHECK(harness_tx_bytes(HARNESS_PORT_TOUCH) == 18);
+    CHECK(usbstat_cdc(HARNESS_PORT_TOUCH)->stale == 19);
+
+    harness_hold(HARNESS_PORT_TOUCH, false);
+    mai_hot.serial_latest = 0;
+}
+
+/* runs 100us rounds until a frame goes out, at most us long */
+static bool run_until_frame(uint32_t us)
+{
+    uint64_t bytes = harness_tx_bytes(HARNESS_PORT_TOUCH);
+    for (uint32_t t = 0; t < us; t += 100) {
+        harness_run(100, 100);
+        if (harness_tx_bytes(HARNESS_PORT_TOUCH) != bytes) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void check_serial_change()
+{
+    mai_hot.stamp = 0;
+    mai_hot.serial_latest = 0;
+    mai_hot.serial_on_change = 1;
+    mai_hot.serial_keepalive = 8000;
+    mai_hot.serial_min_gap = 0;
+
+    harness_reset();
+    CHECK(run_until_frame(10000)); // lines up with a keepalive frame
+    uint64_t bytes = harness_tx_bytes(HARNESS_PORT_TOUCH);
+    harness_run(4000, 100);
+    CHECK(harness_tx_bytes(HARNESS_PORT_TOUCH) == bytes);
+
+    /* a change goes out in the round touch_update() saw it */
+    harness_set_touch(0x21);
+    harness_run(100, 100);
+    CHECK(harness_tx_bytes(HARNESS_PORT_TOUCH) == bytes + 9);
+    uint32_t len;
+    const uint8_t *tx = harness_tx(HARNESS_PORT_TOUCH, &len);
+    CHECK(memcmp(tx + len - 9, "(\x01\x01\0\0\0\0\0)", 9) == 0);
+
+    /* and restarts the keepalive: nothing where the old one was due */
+    harness_run(7800, 100);
+    CHECK(harness_tx_bytes(HARNESS_PORT_TOUCH) == bytes + 9);
+    harness_run(200, 100);
+    CHECK(harness_tx_bytes(HARNESS_PORT_TOUCH) == bytes + 18);
+
+    /* min gap: a change right after that keepalive waits for the gap */
+    mai_hot.serial_min_gap = 1000;
+    harness_set_touch(0x23);
+    harness_run(800, 100);
+    CHECK(harness_tx_bytes(HARNESS_PORT_TOUCH) == bytes + 18);
+    harness_run(200, 100);
+    CHECK(harness_tx_bytes(HARNESS_PORT_TOUCH) == bytes + 27);
+    tx = harness_tx(HARNESS_PORT_TOUCH, &len);
+    CHECK(memcmp(tx + len - 9, "(\x03\x01\0\0\0\0\0)", 9) == 0);
+
+    mai_hot.serial_on_change = 0;
+    mai_hot.serial_keepalive = 1000;
+    mai_hot.serial_min_gap = 0;
+}
+
+/* IO4 buttons are active low, button 0 is bit 2 of the first word */
+static bool joy_pressed_0()
+{
+    const uint8_t *report = harness_hid_last(0);
+    uint16_t io4 = report[28] | (report[29] << 8);
+    return !(io4 & (1 << 2));
+}
+
+static void latch_setup(uint8_t frames)
+{
+    harness_reset();
+    mai_hot.hid_joy = 1;
+    mai_hot.hid_nkro = 0;
+    mai_hot.hid_keepalive = 0;
+    mai_hot.hid_touch = 0;
+    mai_hot.stamp = 0;
+    mai_hot.latch_buttons = 0xffffffff;
+    mai_hot.latch_frames = frames;
+    hid_update();
+    hid_update(); // the report before the tap has gone out
+}
+
+/* a tap that comes in after a report went out shows in the next ones */
+static void check_latch(uint8_t frames)
+{
+    latch_setup(frames);
+    harness_press(1);
+    int shown = 0;
+    for (int i = 0; i < frames + 2; i++) {
+        hid_update();
+        shown += joy_pressed_0();
+    }
+    CHECK(harness_hid_reports(0) == frames + 4);
+    CHECK(shown == frames);
+}
+
+/* same with the endpoint busy, the tap waits in the staged report */
+static void check_latch_busy(uint8_t frames)
+{
+    latch_setup(frames);
+    harness_hid_busy(0, true);
+    hid_update(); // in flight, without the tap
+    harness_press(1);
+    hid_update();
+    hid_update();
+    CHECK(harness_hid_reports(0) == 3);
+    CHECK(!joy_pressed_0());
+
+    int shown = 0;
+    for (int i = 0; i < frames + 2; i++) {
+        harness_hid_complete(0);
+        shown += joy_pressed_0();
+        hid_update();
+    }
+    CHECK(shown == frames);
+    harness_hid_busy(0, false);
+    harness_hid_complete(0);
+}
+
+int main()
+{
+    for (uint32_t chunk = 0; chunk < 24; chunk++) {
+        check_set_color(chunk);
+        check_escapes(chunk);
+    }
+    check_bad_frames();
+    check_burst();
+    check_touch();
+    check_serial_latest();
+    check_serial_change();
+    for (uint8_t frames = 1; frames < 5; frames++) {
+        check_latch(frames);
+        check_latch_busy(frames);
+    }
+
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * Fuzz entry for the io.c protocol engine
+ *
+ * With libFuzzer (clang, IO_FUZZ_LIBFUZZER=ON) this is just the entry
+ * point. Otherwise a small standalone driver runs it over the files given,
+ * or over generated input that is heavy on SYNC, ESCAPE, brackets and
+ * well formed LED frames, so the sanitizers get to see the odd cases.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "harness.h"
+
+/* first byte: bit 0 picks the port, the rest is the FIFO read size */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size < 1) {
+        return 0;
+    }
+    int port = (data[0] & 1) ? HARNESS_PORT_TOUCH : HARNESS_PORT_LED;
+    harness_reset();
+    harness_feed(port, data + 1, size - 1, data[0] >> 1);
+    return 0;
+}
+
+#ifdef IO_FUZZ_STANDALONE
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng()
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static size_t generate(uint8_t *buf, size_t max)
+{
+    static const uint8_t specials[] = { LED_SYNC, LED_ESCAPE, '{', '}' };
+    size_t len = 1 + rng() % (max / 2);
+    size_t pos = 0;
+    buf[pos++] = rng();
+    while (pos < len) {
+        uint32_t pick = rng() % 16;
+        if ((pick == 0) && (pos + 2 * 40 < max)) {
+            uint8_t payload[32];
+            uint8_t payload_len = rng() % sizeof(payload);
+            for (int i = 0; i < payload_len; i++) {
+                payload[i] = rng();
+            }
+            pos += harness_led_frame(buf + pos, rng(), rng(), rng(),
+                                     payload, payload_len);
+        } else if (pick < 5) {
+            buf[pos++] = specials[rng() % sizeof(specials)];
+        } else {
+            buf[pos++] = rng();
+        }
+    }
+    return pos;
+}
+
+static int run_file(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+    static uint8_t buf[1 << 20];
+    size_t len = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+    LLVMFuzzerTestOneInput(buf, len);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    long runs = 100000;
+    int files = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "-runs=", 6) == 0) {
+            runs = atol(argv[i] + 6);
+        } else if (strncmp(argv[i], "-seed=", 6) == 0) {
+            rng_state = atol(argv[i] + 6) | 1;
+        } else {
+            if (run_file(argv[i]) != 0) {
+                return 1;
+            }
+            files++;
+        }
+    }
+    if (files) {
+        printf("%d file(s) done\n", files);
+        return 0;
+    }
+
+    static uint8_t buf[2048];
+    for (long i = 0; i < runs; i++) {
+        size_t len = generate(buf, sizeof(buf));
+        LLVMFuzzerTestOneInput(buf, len);
+    }
+    printf("%ld runs done\n", runs);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,409 @@
+/*
+ * Host harness for the io.c protocol engine
+ */
+
+#include "harness.h"
+
+#include <stdarg.h>
+#include <string.h>
+
+#include "tusb.h"
+#include "io.h"
+#include "config.h"
+#include "rgb.h"
+#include "touch.h"
+#include "usb_descriptors.h"
+#include "usbstat.h"
+#include "analog.h"
+#include "button.h"
+#include "event.h"
+
+#define PORT_NUM 4
+
+mai_hot_t mai_hot;
+mai_runtime_t mai_runtime;
+
+static uint64_t now_us;
+static bool verbose;
+
+static struct {
+    const uint8_t *data;
+    uint32_t len;
+    uint32_t chunk;
+} rx[PORT_NUM];
+
+static struct {
+    uint8_t buf[HARNESS_TX_MAX];
+    uint32_t len;
+    uint64_t bytes;
+    uint64_t frames;
+    uint32_t fifo; // bytes the host hasn't taken yet
+    bool hold;
+} tx[PORT_NUM];
+
+static uint32_t button_color[HARNESS_BUTTONS];
+static uint64_t rgb_calls;
+static uint64_t touch_map;
+
+static struct {
+    bool busy;
+    bool in_flight;
+    uint32_t reports;
+    uint8_t last[64];
+} hid[2];
+
+static uint32_t buttons;
+static uint32_t presses;
+
+int harness_printf(const char *format, ...)
+{
+    if (!verbose) {
+        return 0;
+    }
+    va_list args;
+    va_start(args, format);
+    int ret = vprintf(format, args);
+    va_end(args);
+    return ret;
+}
+
+void harness_verbose(bool on)
+{
+    verbose = on;
+}
+
+uint64_t time_us_64()
+{
+    return now_us;
+}
+
+uint32_t time_us_32()
+{
+    return now_us;
+}
+
+int usb_cdc_itf(int port)
+{
+    return ((port > 0) && (port < PORT_NUM)) ? port : -1;
+}
+
+bool tud_cdc_n_connected(uint8_t itf)
+{
+    return true;
+}
+
+uint32_t tud_cdc_n_available(uint8_t itf)
+{
+    return (itf < PORT_NUM) ? rx[itf].len : 0;
+}
+
+uint32_t tud_cdc_n_read(uint8_t itf, void *buffer, uint32_t bufsize)
+{
+    if (itf >= PORT_NUM) {
+        return 0;
+    }
+    uint32_t count = rx[itf].len;
+    if (rx[itf].chunk && (count > rx[itf].chunk)) {
+        count = rx[itf].chunk;
+    }
+    if (count > bufsize) {
+        count = bufsize;
+    }
+    memcpy(buffer, rx[itf].data, count);
+    rx[itf].data += count;
+    rx[itf].len -= count;
+    return count;
+}
+
+uint32_t tud_cdc_n_write_available(uint8_t itf)
+{
+    if (itf >= PORT_NUM) {
+        return 0;
+    }
+    return CFG_TUD_CDC_TX_BUFSIZE - tx[itf].fifo;
+}
+
+uint32_t tud_cdc_n_write(uint8_t itf, const void *buffer, uint32_t bufsize)
+{
+    if (itf >= PORT_NUM) {
+        return 0;
+    }
+    uint32_t available = tud_cdc_n_write_available(itf);
+    if (bufsize > available) {
+        bufsize = available;
+    }
+    if (tx[itf].hold) {
+        tx[itf].fifo += bufsize;
+    }
+    const uint8_t *data = buffer;
+    for (uint32_t i = 0; i < bufsize; i++) {
+        if (data[i] == LED_SYNC) {
+            tx[itf].frames++;
+        }
+    }
+    uint32_t room = HARNESS_TX_MAX - tx[itf].len;
+    uint32_t keep = (bufsize < room) ? bufsize : room;
+    memcpy(tx[itf].buf + tx[itf].len, data, keep);
+    tx[itf].len += keep;
+    tx[itf].bytes += bufsize;
+    return bufsize;
+}
+
+uint32_t tud_cdc_n_write_flush(uint8_t itf)
+{
+    return 0;
+}
+
+bool tud_hid_n_ready(uint8_t instance)
+{
+    return (instance < 2) && !hid[instance].in_flight;
+}
+
+bool tud_hid_n_report(uint8_t instance, uint8_t report_id, const void *report, uint16_t len)
+{
+    if (!tud_hid_n_ready(instance)) {
+        return false;
+    }
+    if (len > sizeof(hid[instance].last)) {
+        len = sizeof(hid[instance].last);
+    }
+    memcpy(hid[instance].last, report, len);
+    hid[instance].reports++;
+    hid[instance].in_flight = hid[instance].busy;
+    return true;
+}
+
+void harness_hid_busy(int itf, bool busy)
+{
+    if ((itf >= 0) && (itf < 2)) {
+        hid[itf].busy = busy;
+    }
+}
+
+void harness_hid_complete(int itf)
+{
+    if ((itf >= 0) && (itf < 2)) {
+        hid[itf].in_flight = false;
+        tud_hid_report_complete_cb(itf, hid[itf].last, 0);
+    }
+}
+
+uint32_t harness_hid_reports(int itf)
+{
+    return ((itf >= 0) && (itf < 2)) ? hid[itf].reports : 0;
+}
+
+const uint8_t *harness_hid_last(int itf)
+{
+    return ((itf >= 0) && (itf < 2)) ? hid[itf].last : NULL;
+}
+
+bool usb_has_nkro()
+{
+    return true;
+}
+
+void harness_buttons(uint32_t state)
+{
+    buttons = state;
+}
+
+void harness_press(uint32_t mask)
+{
+    presses |= mask;
+}
+
+uint8_t button_num()
+{
+    return 12;
+}
+
+uint8_t button_expander_num()
+{
+    return 0;
+}
+
+uint32_t button_read()
+{
+    return buttons;
+}
+
+uint32_t button_read_delayed(uint8_t ticks)
+{
+    return buttons;
+}
+
+uint32_t button_take_presses()
+{
+    uint32_t taken = presses;
+    presses = 0;
+    return taken;
+}
+
+uint8_t button_real_gpio(int id)
+{
+    return id;
+}
+
+void button_set_sampling(uint8_t count)
+{
+}
+
+const analog_info_t *analog_info(int id)
+{
+    return NULL;
+}
+
+void event_subscribe(event_sub_t *sub, const char *name)
+{
+}
+
+bool event_next(event_sub_t *sub, event_t *event)
+{
+    return false;
+}
+
+uint64_t touch_touchmap()
+{
+    return touch_map;
+}
+
+uint32_t rgb32(uint32_t r, uint32_t g, uint32_t b, bool gamma_fix)
+{
+    return (r << 16) | (g << 8) | b;
+}
+
+uint32_t gray32(uint32_t c, bool gamma_fix)
+{
+    return rgb32(c, c, c, gamma_fix);
+}
+
+void rgb_set_button(unsigned index, uint32_t color, uint8_t speed)
+{
+    rgb_calls++;
+    if (index < HARNESS_BUTTONS) {
+        button_color[index] = color;
+    }
+}
+
+void rgb_set_cab(unsigned index, uint32_t color)
+{
+    rgb_calls++;
+}
+
+uint64_t touch_touchmap_delayed(uint8_t ticks)
+{
+    return touch_map;
+}
+
+void harness_set_touch(uint64_t map)
+{
+    touch_map = map;
+}
+
+void harness_reset()
+{
+    memset(rx, 0, sizeof(rx));
+    memset(tx, 0, sizeof(tx));
+    memset(button_color, 0, sizeof(button_color));
+    rgb_calls = 0;
+    touch_map = 0;
+    memset(hid, 0, sizeof(hid));
+    buttons = 0;
+    presses = 0;
+    usbstat_reset();
+}
+
+void harness_feed(int port, const uint8_t *data, uint32_t len, uint32_t chunk)
+{
+    if ((port <= 0) || (port >= PORT_NUM)) {
+        return;
+    }
+    rx[port].data = data;
+    rx[port].len = len;
+    rx[port].chunk = chunk;
+    while (rx[port].len > 0) {
+        io_update();
+        now_us += 100;
+    }
+}
+
+void harness_run(uint32_t us, uint32_t step)
+{
+    for (uint32_t t = 0; t < us; t += step) {
+        io_update();
+        io_touch_update();
+        now_us += step;
+    }
+}
+
+void harness_hold(int port, bool hold)
+{
+    if ((port > 0) && (port < PORT_NUM)) {
+        tx[port].hold = hold;
+        tx[port].fifo = 0;
+    }
+}
+
+void harness_drain(int port)
+{
+    if ((port > 0) && (port < PORT_NUM)) {
+        tx[port].fifo = 0;
+    }
+}
+
+const uint8_t *harness_tx(int port, uint32_t *len)
+{
+    *len = tx[port].len;
+    return tx[port].buf;
+}
+
+uint64_t harness_tx_bytes(int port)
+{
+    return tx[port].bytes;
+}
+
+uint64_t harness_tx_frames(int port)
+{
+    return tx[port].frames;
+}
+
+uint32_t harness_button_color(unsigned index)
+{
+    return (index < HARNESS_BUTTONS) ? button_color[index] : 0;
+}
+
+uint64_t harness_rgb_calls()
+{
+    return rgb_calls;
+}
+
+static int put_escaped(uint8_t *out, uint8_t c)
+{
+    if ((c == LED_SYNC) || (c == LED_ESCAPE)) {
+        out[0] = LED_ESCAPE;
+        out[1] = c - 1;
+        return 2;
+    }
+    out[0] = c;
+    return 1;
+}
+
+int harness_led_frame(uint8_t *out, uint8_t dst, uint8_t src, uint8_t cmd,
+                      const uint8_t *payload, uint8_t payload_len)
+{
+    uint8_t raw[4 + 255] = { dst, src, payload_len + 1, cmd };
+    if (payload_len) {
+        memcpy(raw + 4, payload, payload_len);
+    }
+
+    int len = 0;
+    uint8_t checksum = 0;
+    out[len++] = LED_SYNC;
+    for (int i = 0; i < payload_len + 4; i++) {
+        checksum += raw[i];
+        len += put_escaped(out + len, raw[i]);
+    }
+    len += put_escaped(out + len, checksum);
+    return len;
+}
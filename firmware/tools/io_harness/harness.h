@@ -0,0 +1,67 @@
+/*
+ * Host harness for the io.c protocol engine
+ *
+ * io.c, hid.c, cdc_tx.c, usbstat.c and stamp.c are built as they are,
+ * the USB stack, buttons, RGB and touch underneath them are faked here.
+ * Bytes go in through a fake CDC FIFO and io_update(), whatever io.c
+ * answers is captured per port. HID reports are captured per instance.
+ */
+
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HARNESS_TX_MAX 4096
+#define HARNESS_FIFO_SIZE 128 // CFG_TUD_CDC_TX_BUFSIZE
+#define HARNESS_BUTTONS 16
+
+#define LED_SYNC 0xe0
+#define LED_ESCAPE 0xd0
+
+/* same numbering as enum usb_port */
+#define HARNESS_PORT_TOUCH 1
+#define HARNESS_PORT_LED 2
+
+void harness_reset();
+void harness_verbose(bool on); // io.c log messages, off by default
+
+/* Hands data to io.c, at most chunk bytes per FIFO read (0: no limit) */
+void harness_feed(int port, const uint8_t *data, uint32_t len, uint32_t chunk);
+
+/* Runs the classic loop for us microseconds, one round every step */
+void harness_run(uint32_t us, uint32_t step);
+
+/* The TX FIFO is drained as soon as it's written, unless held: then it
+   fills up to HARNESS_FIFO_SIZE and only harness_drain() empties it */
+void harness_hold(int port, bool hold);
+void harness_drain(int port);
+
+/* Captured output, capped at HARNESS_TX_MAX, frames counts SYNC bytes */
+const uint8_t *harness_tx(int port, uint32_t *len);
+uint64_t harness_tx_bytes(int port);
+uint64_t harness_tx_frames(int port);
+
+void harness_set_touch(uint64_t map); // what touch_update() last read
+
+uint32_t harness_button_color(unsigned index);
+uint64_t harness_rgb_calls();
+
+/* HID: on a busy endpoint each report stays in flight, the next one
+   can't go out before harness_hid_complete() */
+void harness_hid_busy(int itf, bool busy);
+void harness_hid_complete(int itf); // the host took the report
+uint32_t harness_hid_reports(int itf);
+const uint8_t *harness_hid_last(int itf); // last report handed over
+
+/* What the button layer shows hid.c: live state and presses since the
+   last hid_update(), both in button id bits */
+void harness_buttons(uint32_t state);
+void harness_press(uint32_t presses);
+
+/* Builds an escaped LED frame with its checksum, returns its length */
+int harness_led_frame(uint8_t *out, uint8_t dst, uint8_t src, uint8_t cmd,
+                      const uint8_t *payload, uint8_t payload_len);
+
+#endif
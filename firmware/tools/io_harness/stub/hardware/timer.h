@@ -0,0 +1,13 @@
+/*
+ * Host stand-in for the pico timer, driven by the harness
+ */
+
+#ifndef HARDWARE_TIMER_H_
+#define HARDWARE_TIMER_H_
+
+#include <stdint.h>
+
+uint64_t time_us_64();
+uint32_t time_us_32();
+
+#endif
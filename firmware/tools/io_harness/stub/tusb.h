@@ -0,0 +1,31 @@
+/*
+ * Host stand-in for TinyUSB, only what io.c, hid.c and friends touch
+ */
+
+#ifndef TUSB_H_
+#define TUSB_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hardware/timer.h"
+
+#define CFG_TUD_CDC_TX_BUFSIZE 128
+
+bool tud_cdc_n_connected(uint8_t itf);
+uint32_t tud_cdc_n_available(uint8_t itf);
+uint32_t tud_cdc_n_read(uint8_t itf, void *buffer, uint32_t bufsize);
+uint32_t tud_cdc_n_write(uint8_t itf, const void *buffer, uint32_t bufsize);
+uint32_t tud_cdc_n_write_flush(uint8_t itf);
+uint32_t tud_cdc_n_write_available(uint8_t itf);
+
+bool tud_hid_n_ready(uint8_t instance);
+bool tud_hid_n_report(uint8_t instance, uint8_t report_id, const void *report, uint16_t len);
+void tud_hid_report_complete_cb(uint8_t instance, uint8_t const *report, uint16_t len);
+
+/* io.c logs with printf, the harness decides whether it's shown */
+int harness_printf(const char *format, ...);
+#define printf harness_printf
+
+#endif
@@ -0,0 +1,217 @@
+/*
+ * Telemetry Stream to CSV
+ * WHowe <github.com/whowechina>
+ *
+ * Reads the vendor bulk telemetry stream (service USB profile only) and
+ * writes one CSV line per frame to stdout, summary goes to stderr.
+ *
+ * Build: g++ -O2 -std=c++17 -I../../src telemetry_csv.cpp -lusb-1.0 \
+ *            -o telemetry_csv
+ * Usage: telemetry_csv [-s] [-n frames] > telemetry.csv
+ *        -s: include MPR121 filtered and baseline readouts
+ */
+
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <libusb-1.0/libusb.h>
+
+#include "telemetry.h"
+
+static const uint16_t vid = 0x0ca3;
+static const uint16_t pid = 0x0021;
+
+static volatile bool running = true;
+
+static void on_signal(int)
+{
+    running = false;
+}
+
+struct vendor_itf {
+    int number = -1;
+    uint8_t ep_in = 0;
+    uint8_t ep_out = 0;
+};
+
+static vendor_itf find_vendor_itf(libusb_device_handle *dev)
+{
+    vendor_itf found;
+    libusb_config_descriptor *config;
+    if (libusb_get_active_config_descriptor(libusb_get_device(dev), &config) != 0) {
+        return found;
+    }
+    for (int i = 0; i < config->bNumInterfaces; i++) {
+        const libusb_interface_descriptor *itf = &config->interface[i].altsetting[0];
+        if (itf->bInterfaceClass != LIBUSB_CLASS_VENDOR_SPEC) {
+            continue;
+        }
+        found.number = itf->bInterfaceNumber;
+        for (int e = 0; e < itf->bNumEndpoints; e++) {
+            uint8_t addr = itf->endpoint[e].bEndpointAddress;
+            if (addr & LIBUSB_ENDPOINT_IN) {
+                found.ep_in = addr;
+            } else {
+                found.ep_out = addr;
+            }
+        }
+        break;
+    }
+    libusb_free_config_descriptor(config);
+    return found;
+}
+
+static bool send_cmd(libusb_device_handle *dev, const vendor_itf &itf, uint8_t cmd)
+{
+    int sent = 0;
+    return (libusb_bulk_transfer(dev, itf.ep_out, &cmd, 1, &sent, 1000) == 0) &&
+           (sent == 1);
+}
+
+static void print_header(bool sensors)
+{
+    printf("seq,time_us,buttons,touch,round_us,gap_us,dropped");
+    if (sensors) {
+        printf(",sensor");
+        for (int i = 0; i < 12; i++) {
+            printf(",filtered%d", i);
+        }
+        for (int i = 0; i < 12; i++) {
+            printf(",baseline%d", i);
+        }
+    }
+    printf("\n");
+}
+
+static void print_frame(const telemetry_frame_t &frame, bool sensors)
+{
+    printf("%u,%u,0x%08x,0x%09llx,%u,%u,%u", frame.seq, frame.time_us,
+           frame.buttons, (unsigned long long)frame.touch, frame.round_us,
+           frame.gap_us, frame.dropped);
+    if (sensors) {
+        if (frame.sensor == TELEMETRY_NO_SENSOR) {
+            printf(",");
+            for (int i = 0; i < 24; i++) {
+                printf(",");
+            }
+        } else {
+            printf(",%u", frame.sensor);
+            for (int i = 0; i < 12; i++) {
+                printf(",%u", frame.filtered[i]);
+            }
+            for (int i = 0; i < 12; i++) {
+                printf(",%u", frame.baseline[i]);
+            }
+        }
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    bool sensors = false;
+    long limit = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0) {
+            sensors = true;
+        } else if ((strcmp(argv[i], "-n") == 0) && (i + 1 < argc)) {
+            limit = atol(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [-s] [-n frames]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (libusb_init(nullptr) != 0) {
+        fprintf(stderr, "libusb init failed\n");
+        return 1;
+    }
+
+    libusb_device_handle *dev = libusb_open_device_with_vid_pid(nullptr, vid, pid);
+    if (!dev) {
+        fprintf(stderr, "Controller not found\n");
+        libusb_exit(nullptr);
+        return 1;
+    }
+
+    vendor_itf itf = find_vendor_itf(dev);
+    if ((itf.number < 0) || !itf.ep_in || !itf.ep_out) {
+        fprintf(stderr, "No telemetry interface, is it in the service USB profile?\n");
+        libusb_close(dev);
+        libusb_exit(nullptr);
+        return 1;
+    }
+    if (libusb_claim_interface(dev, itf.number) != 0) {
+        fprintf(stderr, "Can't claim the telemetry interface\n");
+        libusb_close(dev);
+        libusb_exit(nullptr);
+        return 1;
+    }
+
+    signal(SIGINT, on_signal);
+
+    uint8_t cmd = TELEMETRY_CMD_STREAM | (sensors ? TELEMETRY_CMD_SENSORS : 0);
+    if (!send_cmd(dev, itf, cmd)) {
+        fprintf(stderr, "Can't start streaming\n");
+        running = false;
+    }
+
+    print_header(sensors);
+
+    std::vector<uint8_t> pending;
+    uint8_t buf[4096];
+    long frames = 0;
+    uint64_t missed = 0;
+    uint64_t resyncs = 0;
+    bool have_seq = false;
+    uint32_t next_seq = 0;
+
+    while (running && (!limit || (frames < limit))) {
+        int got = 0;
+        int rc = libusb_bulk_transfer(dev, itf.ep_in, buf, sizeof(buf), &got, 500);
+        if ((rc != 0) && (rc != LIBUSB_ERROR_TIMEOUT)) {
+            fprintf(stderr, "Read failed: %s\n", libusb_error_name(rc));
+            break;
+        }
+        pending.insert(pending.end(), buf, buf + got);
+
+        size_t pos = 0;
+        while (pending.size() - pos >= sizeof(telemetry_frame_t)) {
+            telemetry_frame_t frame;
+            memcpy(&frame, &pending[pos], sizeof(frame));
+            if ((frame.magic != TELEMETRY_MAGIC) ||
+                (frame.version != TELEMETRY_VERSION)) {
+                pos++; // lost alignment, slide until the next frame start
+                resyncs++;
+                continue;
+            }
+            pos += sizeof(frame);
+
+            if (have_seq && (frame.seq != next_seq)) {
+                missed += frame.seq - next_seq;
+            }
+            have_seq = true;
+            next_seq = frame.seq + 1;
+
+            print_frame(frame, sensors);
+            frames++;
+            if (limit && (frames >= limit)) {
+                break;
+            }
+        }
+        pending.erase(pending.begin(), pending.begin() + pos);
+    }
+
+    send_cmd(dev, itf, 0);
+    libusb_release_interface(dev, itf.number);
+    libusb_close(dev);
+    libusb_exit(nullptr);
+
+    fprintf(stderr, "%ld frames, %llu missed, %llu bytes skipped to resync\n",
+            frames, (unsigned long long)missed, (unsigned long long)resyncs);
+    return 0;
+}